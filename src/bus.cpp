@@ -3,7 +3,7 @@
 #include <iostream>
 
 
-Bus::Bus(const std::string& bios_name, uint32_t* tex_target) : gs {*this, tex_target} {
+Bus::Bus(const std::string& bios_name) : gs {*this} {
 	bios.resize(1024 * 1024 * 4);
 	main_ram.resize(1024 * 1024 * 32);
 	iop_ram.resize(1024 * 1024 * 2);
@@ -77,7 +77,24 @@ uint32_t Bus::read32(uint32_t addr) {
 	}
 	// GIF_STAT
 	else if (addr == 0x10003020) {
-		return gif.stat;
+		// APATH is the path in the middle of a packet
+		uint32_t stat = gif.stat | static_cast<uint32_t>(gif.active_path) << 10;
+		// M3P is PATH3 masked by VIF1
+		stat |= static_cast<uint32_t>(gif.path3_masked) << 1;
+		// while the bus points at the ee, DIR is set and FQC counts the readback data left
+		if (gs.busdir & 1) {
+			size_t qwords = (gs.readback.size() - gs.readback_pos) / 2;
+			stat |= 1U << 12 | static_cast<uint32_t>(std::min<size_t>(qwords, 16)) << 24;
+		}
+		return stat;
+	}
+	// VIF0 registers
+	else if (addr >= 0x10003800 && addr < 0x10003C00) {
+		return vif0.read(addr);
+	}
+	// VIF1 registers
+	else if (addr >= 0x10003C00 && addr < 0x10004000) {
+		return vif1.read(addr);
 	}
 	// SIF_MSCOM
 	else if (addr == 0x1000F200) {
@@ -155,6 +172,7 @@ uint32_t Bus::read32(uint32_t addr) {
 	}
 	// GS_CSR
 	else if (addr == 0x12001000) {
+		gs.sync();
 		return gs.csr;
 	}
 	// reserved
@@ -172,8 +190,21 @@ uint64_t Bus::read64(uint32_t addr) {
 	}
 	// GS_CSR
 	else if (addr == 0x12001000) {
+		gs.sync();
 		return gs.csr;
 	}
+	// GS_SIGLBLID
+	else if (addr == 0x12001080) {
+		gs.sync();
+		return gs.siglblid;
+	}
+	// GIF FIFO, local->host transfer data
+	else if (addr == 0x10006000) {
+		return gs.read_fifo(false);
+	}
+	else if (addr == 0x10006008) {
+		return gs.read_fifo(true);
+	}
 
 	return read32(addr) | static_cast<uint64_t>(read32(addr + 4)) << 32;
 }
@@ -298,6 +329,14 @@ void Bus::write32(uint32_t addr, uint32_t value) {
 	// VIF0_FBRST
 	else if (addr == 0x10003810) {
 		vif0.fbrst = value;
+		if (value & 1) {
+			vif0.reset();
+		}
+		// STC
+		if (value & 1U << 3) {
+			vif0.cancel_stall();
+			dmac.kick();
+		}
 	}
 	// VIF0_ERR
 	else if (addr == 0x10003820) {
@@ -307,21 +346,29 @@ void Bus::write32(uint32_t addr, uint32_t value) {
 	else if (addr == 0x10003830) {
 		vif0.mark = value;
 	}
-	// VIF1_STAT
+	// VIF1_STAT, only FDR can be written
 	else if (addr == 0x10003C00) {
-		vif1.stat = value;
+		vif1.stat = (vif1.stat & ~(1U << 23)) | (value & 1U << 23);
 	}
 	// VIF1_FBRST
 	else if (addr == 0x10003C10) {
 		vif1.fbrst = value;
+		if (value & 1) {
+			vif1.reset();
+		}
+		// STC
+		if (value & 1U << 3) {
+			vif1.cancel_stall();
+			dmac.kick();
+		}
 	}
 	// VIF0_FIFO
 	else if (addr >= 0x10004000 && addr < 0x10005000) {
-		// todo vif0 fifo
+		vif0.fifo_write32(addr, value);
 	}
 	// VIF1_FIFO
 	else if (addr >= 0x10005000 && addr < 0x10006000) {
-		// todo vif1 fifo
+		vif1.fifo_write32(addr, value);
 	}
 	// SIF_MSCOM
 	else if (addr == 0x1000F200) {
@@ -345,6 +392,7 @@ void Bus::write32(uint32_t addr, uint32_t value) {
 	// DMAC D_CTRL
 	else if (addr == 0x1000E000) {
 		dmac.ctrl = value;
+		dmac.kick();
 	}
 	// DMAC D_STAT
 	else if (addr == 0x1000E010) {
@@ -354,6 +402,7 @@ void Bus::write32(uint32_t addr, uint32_t value) {
 	// DMAC D_PCR
 	else if (addr == 0x1000E020) {
 		dmac.pcr = value;
+		dmac.kick();
 	}
 	// DMAC SQWC
 	else if (addr == 0x1000E030) {
@@ -370,6 +419,7 @@ void Bus::write32(uint32_t addr, uint32_t value) {
 	// DMAC D_ENABLEW
 	else if (addr == 0x1000F590) {
 		dmac.enablew = value;
+		dmac.kick();
 	}
 	// unknown dram
 	else if (addr == 0x1000F440) {
@@ -393,8 +443,11 @@ void Bus::write32(uint32_t addr, uint32_t value) {
 	}
 	// GS_CSR
 	else if (addr == 0x12001000) {
-		gs.csr &= 0xFFFFFFFF00000000;
-		gs.csr |= value;
+		gs.write_csr((gs.csr & 0xFFFFFFFF00000000) | value);
+	}
+	// GS_BUSDIR
+	else if (addr == 0x12001040) {
+		gs.busdir = value;
 	}
 	else {
 		write16(addr, value);
@@ -410,20 +463,36 @@ void Bus::write64(uint32_t addr, uint64_t value) {
 	else if (addr == 0x12000000) {
 		gs.pmode = value;
 	}
+	else if (addr == 0x12000020) {
+		gs.smode2 = value;
+	}
+	else if (addr == 0x12000070) {
+		gs.dispfb1 = value;
+	}
+	else if (addr == 0x12000080) {
+		gs.display1 = value;
+	}
 	else if (addr == 0x12000090) {
 		gs.dispfb2 = value;
 	}
 	else if (addr == 0x120000A0) {
 		gs.display2 = value;
 	}
+	else if (addr == 0x120000E0) {
+		gs.bgcolor = value;
+	}
 	// GS_CSR
 	else if (addr == 0x12001000) {
-		gs.csr = value;
+		gs.write_csr(value);
 	}
 	// GS_IMR
 	else if (addr == 0x12001010) {
 		gs.imr = value;
 	}
+	// GS_BUSDIR
+	else if (addr == 0x12001040) {
+		gs.busdir = value;
+	}
 	// GIF FIFO
 	else if (addr == 0x10006000) {
 		gif.fifo[0] = value;
@@ -438,7 +507,7 @@ void Bus::write64(uint32_t addr, uint64_t value) {
 	else if (addr == 0x10007018) {
 		ipu.fifo[1] = value;
 	}
-	// SMODE1, SMODE2, SRFSH, SYNCH1, SYNCH2, SYNCV
+	// SMODE1, SRFSH, SYNCH1, SYNCH2, SYNCV
 	else if (addr >= 0x12000010 && addr < 0x12000068) {
 
 	}
@@ -14,7 +14,7 @@
 #include <string>
 
 struct Bus {
-	Bus(const std::string& bios_name, uint32_t* tex_target);
+	explicit Bus(const std::string& bios_name);
 	uint8_t read8(uint32_t addr);
 	uint16_t read16(uint32_t addr);
 	uint32_t read32(uint32_t addr);
@@ -39,8 +39,8 @@ struct Bus {
 	Gif gif {*this};
 	Gs gs;
 	Dmac dmac {*this};
-	Vif vif0 {*this};
-	Vif vif1 {*this};
+	Vif vif0 {*this, 0};
+	Vif vif1 {*this, 1};
 	Ipu ipu {*this};
 	Sif sif {*this};
 	Scheduler scheduler {*this};
@@ -3,14 +3,24 @@
 #include "utils.hpp"
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 
 #define D_CTRL_ENABLE (1 << 0)
+#define D_CTRL_RELE (1 << 1)
+#define D_CTRL_RCYC(ctrl) ((ctrl) >> 8 & 0b111)
+
+#define D_PCR_CDE(channel) (1U << (16 + (channel)))
+#define D_PCR_PCE (1U << 31)
+
+#define D_ENABLE_HOLD (1U << 16)
 
 #define D_CHCR_DIR(chcr) ((chcr) & 1)
 #define D_DIR_TO_MEM 0
 #define D_DIR_FROM_MEM 1
 #define D_CHCR_MOD(chcr) ((chcr) >> 2 & 0b11)
 #define D_CHCR_ASP(chcr) ((chcr) >> 4 & 0b11)
+#define D_CHCR_ASP_VALUE(asp) ((static_cast<uint32_t>(asp)) << 4)
+#define D_CHCR_ASP_MASK (0b11U << 4)
 #define D_CHCR_TTE (1U << 6)
 #define D_CHCR_TIE (1U << 7)
 #define D_CHCR_STR (1U << 8)
@@ -58,8 +68,9 @@ void Dmac::write(uint32_t addr, uint32_t value) {
 	}
 
 	if (reg == 0x00) {
+		bool was_running = channel->chcr & D_CHCR_STR;
 		channel->chcr = value;
-		if (!(value & D_CHCR_STR) || !(ctrl & D_CTRL_ENABLE)) {
+		if (!(value & D_CHCR_STR) || was_running) {
 			return;
 		}
 
@@ -74,68 +85,18 @@ void Dmac::write(uint32_t addr, uint32_t value) {
 			assert(mode == 1);
 			assert(!channel->qwc && "not implemented");
 		}
+		// VIF0, VIF1
+		else if (base == 0x10008000 || base == 0x10009000) {
+			assert(D_CHCR_DIR(value) == D_DIR_FROM_MEM && "unimplemented vif to memory dma");
+			assert((mode == 0 || mode == 1) && "unimplemented vif dma mode");
+			channel->tag_end = false;
+			kick();
+		}
 		// GIF
 		else if (base == 0x1000A000) {
-			if (mode == 0) {
-				while (channel->qwc) {
-					Uint128 packet {
-						bus.read64(channel->madr),
-						bus.read64(channel->madr + 8)
-					};
-					channel->madr += 16;
-					bus.gif.fifo_write(packet);
-					channel->qwc -= 1;
-				}
-
-				channel->chcr &= ~D_CHCR_STR;
-			}
-			else if (mode == 1) {
-				bool irq = false;
-				bool tag_end = false;
-				while (true) {
-					while (channel->qwc) {
-						Uint128 packet {
-							bus.read64(channel->madr),
-							bus.read64(channel->madr + 8)
-						};
-						channel->madr += 16;
-						bus.gif.fifo_write(packet);
-						channel->qwc -= 1;
-					}
-
-					if (((channel->chcr & D_CHCR_TIE) && irq) || tag_end) {
-						break;
-					}
-
-					uint64_t tag[2];
-					tag[0] = bus.read64(channel->tadr);
-					tag[1] = bus.read64(channel->tadr + 8);
-					irq = tag[0] >> 31 & 1;
-
-					uint8_t id = tag[0] >> 28 & 0b111;
-					if (id == 0) {
-						assert(!(tag[0] >> 63));
-						channel->madr = tag[0] >> 32;
-						channel->tadr += 16;
-						tag_end = true;
-					}
-					else if (id == 1) {
-						auto old_madr = channel->madr;
-						channel->madr = channel->tadr + 16;
-						channel->tadr = old_madr;
-						assert(!(channel->chcr & D_CHCR_TTE));
-					}
-					else {
-						assert(false);
-					}
-					channel->qwc = tag[0] & 0xFFFF;
-				}
-
-				channel->chcr &= ~D_CHCR_STR;
-			}
-			else {
-				assert(false);
-			}
+			assert((mode == 0 || mode == 1) && "unimplemented gif dma mode");
+			channel->tag_end = false;
+			kick();
 		}
 		else {
 			assert(false && "unimplemented dma channel started");
@@ -161,6 +122,259 @@ void Dmac::write(uint32_t addr, uint32_t value) {
 	}
 }
 
+std::span<Uint128> Dmac::mem_span(uint32_t addr, uint32_t qwc) {
+	// scratchpad
+	if (addr & 1U << 31) {
+		uint32_t offset = addr & 0x3FF0;
+		auto* ptr = reinterpret_cast<Uint128*>(bus.ee_cpu.scratchpad_ram + offset);
+		return {ptr, std::min<size_t>(qwc, (0x4000 - offset) / 16)};
+	}
+
+	addr &= 0x1FFFFFF0;
+	if (addr < 0x2000000) {
+		auto* ptr = reinterpret_cast<Uint128*>(bus.main_ram.data() + addr);
+		return {ptr, std::min<size_t>(qwc, (0x2000000 - addr) / 16)};
+	}
+
+	std::cerr << "unimplemented dma memory access at "
+	          << std::hex << std::uppercase << addr << std::dec << '\n';
+	abort();
+}
+
+// channels whose transfers are driven by scheduled slices, in priority order
+constexpr uint8_t SLICED_CHANNELS[] {0, 1, 2};
+
+void Dmac::kick() {
+	if (slice_scheduled) {
+		return;
+	}
+	slice_scheduled = true;
+	bus.scheduler.schedule_event({
+		.cycles = 0,
+		.fn = [this]() {
+			run_slice();
+		}
+	});
+}
+
+bool Dmac::peripheral_ready(uint8_t index) {
+	if (index == 0) {
+		return !bus.vif0.stalled();
+	}
+	else if (index == 1) {
+		return !bus.vif1.stalled();
+	}
+	else if (index == 2) {
+		return bus.gif.path_available(3);
+	}
+	return true;
+}
+
+bool Dmac::channel_runnable(uint8_t index) {
+	if (!(channels[index].chcr & D_CHCR_STR) || !(ctrl & D_CTRL_ENABLE) ||
+		(enablew & D_ENABLE_HOLD)) {
+		return false;
+	}
+	if ((pcr & D_PCR_PCE) && !(pcr & D_PCR_CDE(index))) {
+		return false;
+	}
+	return peripheral_ready(index);
+}
+
+bool Dmac::channel_done(uint8_t index) const {
+	const auto& channel = channels[index];
+	if (channel.qwc) {
+		return false;
+	}
+	return D_CHCR_MOD(channel.chcr) == 0 || channel.tag_end;
+}
+
+void Dmac::run_slice() {
+	slice_scheduled = false;
+
+	// the previous slice's transfer has now finished on the bus
+	if (slice_channel >= 0) {
+		if ((channels[slice_channel].chcr & D_CHCR_STR) && channel_done(slice_channel)) {
+			finish_channel(slice_channel);
+		}
+		slice_channel = -1;
+	}
+
+	// a stall that ended with the last slice lets the vifs run what they held back
+	bus.vif0.resume();
+	bus.vif1.resume();
+
+	for (auto index : SLICED_CHANNELS) {
+		if (!channel_runnable(index)) {
+			continue;
+		}
+
+		uint32_t max_qwc = slice_qwc;
+		if (ctrl & D_CTRL_RELE) {
+			max_qwc = std::min(max_qwc, 8U << D_CTRL_RCYC(ctrl));
+		}
+		uint32_t moved = transfer_slice(index, max_qwc);
+
+		// one quadword per bus cycle, the bus runs at half the ee clock
+		size_t cycles = moved * 2;
+		if (ctrl & D_CTRL_RELE) {
+			cycles += DMAC_RELEASE_CYCLES;
+		}
+
+		slice_channel = index;
+		slice_scheduled = true;
+		bus.scheduler.schedule_event({
+			.cycles = cycles,
+			.fn = [this]() {
+				run_slice();
+			}
+		});
+		return;
+	}
+}
+
+uint32_t Dmac::transfer_slice(uint8_t index, uint32_t max_qwc) {
+	auto& channel = channels[index];
+	uint32_t moved = 0;
+	while (moved < max_qwc && !channel_done(index) && peripheral_ready(index)) {
+		if (channel.qwc) {
+			auto data = mem_span(channel.madr, std::min(channel.qwc, max_qwc - moved));
+			auto taken = write_peripheral(index, data);
+			channel.madr += taken * 16;
+			channel.qwc -= taken;
+			moved += taken;
+			// the rest waits in memory until the peripheral takes data again
+			if (taken < data.size()) {
+				break;
+			}
+			continue;
+		}
+
+		// the tag is only followed once the peripheral has taken it, one the gif holds up is sent again next slice
+		if (channel.chcr & D_CHCR_TTE) {
+			auto tag = mem_span(channel.tadr, 1)[0];
+			// the vifs only take the upper half of the tag
+			if (index == 0 || index == 1) {
+				auto& vif = index == 0 ? bus.vif0 : bus.vif1;
+				vif.write_tag(tag);
+			}
+			else if (write_peripheral(index, {&tag, 1}) == 0) {
+				break;
+			}
+		}
+		read_source_tag(channel);
+		moved += 1;
+	}
+	return moved;
+}
+
+size_t Dmac::write_peripheral(uint8_t index, std::span<const Uint128> data) {
+	if (index == 0) {
+		return bus.vif0.fifo_write(data);
+	}
+	else if (index == 1) {
+		return bus.vif1.fifo_write(data);
+	}
+	else if (index == 2) {
+		return bus.gif.fifo_write(data, 3);
+	}
+	else {
+		UNREACHABLE("unimplemented dma peripheral");
+	}
+}
+
+Uint128 Dmac::read_source_tag(Channel& channel) {
+	auto tag = mem_span(channel.tadr, 1)[0];
+	uint32_t tag_addr = tag.low >> 32 & 0xFFFFFFF0;
+	uint8_t id = tag.low >> 28 & 0b111;
+	bool irq = tag.low >> 31 & 1;
+
+	channel.qwc = tag.low & 0xFFFF;
+	channel.chcr = (channel.chcr & ~D_CHCR_TAG_MASK) | D_CHCR_TAG(tag.low >> 16);
+
+	uint8_t asp = D_CHCR_ASP(channel.chcr);
+	switch (id) {
+		// refe
+		case 0:
+			channel.madr = tag_addr;
+			channel.tadr += 16;
+			channel.tag_end = true;
+			break;
+		// cnt
+		case 1:
+			channel.madr = channel.tadr + 16;
+			channel.tadr = channel.madr + channel.qwc * 16;
+			break;
+		// next
+		case 2:
+			channel.madr = channel.tadr + 16;
+			channel.tadr = tag_addr;
+			break;
+		// ref
+		case 3:
+		// refs, stall control is not emulated
+		case 4:
+			channel.madr = tag_addr;
+			channel.tadr += 16;
+			break;
+		// call
+		case 5:
+		{
+			channel.madr = channel.tadr + 16;
+			uint32_t ret_addr = channel.madr + channel.qwc * 16;
+			if (asp == 0) {
+				channel.asr0 = ret_addr;
+			}
+			else if (asp == 1) {
+				channel.asr1 = ret_addr;
+			}
+			else {
+				UNREACHABLE("dma call stack overflow");
+			}
+			channel.chcr = (channel.chcr & ~D_CHCR_ASP_MASK) | D_CHCR_ASP_VALUE(asp + 1);
+			channel.tadr = tag_addr;
+			break;
+		}
+		// ret
+		case 6:
+			channel.madr = channel.tadr + 16;
+			if (asp == 2) {
+				channel.tadr = channel.asr1;
+			}
+			else if (asp == 1) {
+				channel.tadr = channel.asr0;
+			}
+			else {
+				channel.tadr = channel.madr + channel.qwc * 16;
+				channel.tag_end = true;
+			}
+			if (asp) {
+				channel.chcr = (channel.chcr & ~D_CHCR_ASP_MASK) | D_CHCR_ASP_VALUE(asp - 1);
+			}
+			break;
+		// end
+		case 7:
+			channel.madr = channel.tadr + 16;
+			channel.tag_end = true;
+			break;
+	}
+
+	if (irq && (channel.chcr & D_CHCR_TIE)) {
+		channel.tag_end = true;
+	}
+	return tag;
+}
+
+void Dmac::finish_channel(uint8_t index) {
+	auto& channel = channels[index];
+	channel.tag_end = false;
+	channel.chcr &= ~D_CHCR_STR;
+	stat |= 1U << index;
+	if (stat & (stat >> 16 & 0x3FF)) {
+		bus.ee_cpu.raise_int1();
+	}
+}
+
 uint32_t Dmac::read(uint32_t addr) {
 	auto base = addr & 0xFFFFFF00;
 	uint8_t reg = addr & 0xFF;
@@ -283,44 +497,17 @@ void Dmac::clock_sif() {
 	auto& sif1 = channels[6];
 	if ((sif1.chcr & D_CHCR_STR)) {
 		if (sif1.tag_end && !sif1.qwc) {
-			sif1.tag_end = false;
-			sif1.chcr &= ~D_CHCR_STR;
-			// channel 6 IRQ
-			stat |= 1U << 6;
-			if (stat & (stat >> 16 & 0x3FF)) {
-				bus.ee_cpu.raise_int1();
-			}
+			finish_channel(6);
 		}
 		else if (bus.sif.sif1_fifo_size < 15) {
 			if (!sif1.qwc) {
-				uint64_t tag = bus.read64(sif1.tadr);
-				assert(!(sif1.chcr & D_CHCR_TTE));
-
-				bool irq = tag >> 31 & 1;
-				if (irq && sif1.chcr & D_CHCR_TIE) {
-					sif1.tag_end = true;
-				}
-
-				uint8_t id = tag >> 28 & 0b111;
-				if (id == 0) {
-					assert(!(tag >> 63));
-					sif1.madr = tag >> 32;
-					sif1.tadr += 16;
-					sif1.tag_end = true;
-				}
-				else if (id == 3) {
-					assert(!(tag >> 63));
-					sif1.madr = tag >> 32;
-					sif1.tadr += 16;
-				}
-				else {
-					assert(false);
-				}
-				sif1.qwc = tag & 0xFFFF;
+				assert(!(sif1.chcr & D_CHCR_TTE) && "sif1 tag transfer not implemented");
+				read_source_tag(sif1);
 			}
 			else {
-				uint64_t first = bus.read64(sif1.madr);
-				uint64_t second = bus.read64(sif1.madr + 8);
+				auto data = mem_span(sif1.madr, 1)[0];
+				uint64_t first = data.low;
+				uint64_t second = data.high;
 
 				bus.sif.sif1_fifo[bus.sif.sif1_fifo_ee_ptr] = first;
 				bus.sif.sif1_fifo_ee_ptr = (bus.sif.sif1_fifo_ee_ptr + 1) % 16;
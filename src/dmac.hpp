@@ -1,8 +1,13 @@
 #pragma once
 #include <cstdint>
+#include <span>
+#include "utils.hpp"
 
 struct Bus;
 
+// ee cycles the dmac leaves the bus to the ee between slices when cycle stealing is enabled
+#define DMAC_RELEASE_CYCLES 16
+
 struct Dmac {
 	Bus& bus;
 	uint32_t ctrl {};
@@ -25,9 +30,28 @@ struct Dmac {
 		bool tag_end;
 	};
 	Channel channels[10] {};
+	// maximum number of quadwords a channel moves before the dmac arbitrates again
+	uint32_t slice_qwc {64};
+	bool slice_scheduled {};
+	int8_t slice_channel {-1};
+
+	void kick();
 
 	void write(uint32_t addr, uint32_t value);
 	uint32_t read(uint32_t addr);
 
 	void clock_sif();
+
+private:
+	std::span<Uint128> mem_span(uint32_t addr, uint32_t qwc);
+	// the peripheral of a channel can take data, vifs stall and the gif waits for other paths' packets
+	bool peripheral_ready(uint8_t index);
+	bool channel_runnable(uint8_t index);
+	bool channel_done(uint8_t index) const;
+	void run_slice();
+	uint32_t transfer_slice(uint8_t index, uint32_t max_qwc);
+	// returns the quadwords the peripheral took
+	size_t write_peripheral(uint8_t index, std::span<const Uint128> data);
+	Uint128 read_source_tag(Channel& channel);
+	void finish_channel(uint8_t index);
 };
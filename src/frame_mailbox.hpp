@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// hands the newest finished frame from a producer to a consumer without either waiting on the other
+// of the three buffers one is written, one is read and the third holds the newest finished frame
+class FrameMailbox {
+public:
+	explicit FrameMailbox(size_t pixels) {
+		for (auto& frame : frames) {
+			frame.resize(pixels);
+		}
+	}
+
+	// where the producer writes the next frame
+	uint32_t* back() {
+		return frames[back_index].data();
+	}
+
+	// makes the back buffer the newest frame, one published before it and never taken is dropped
+	void publish() {
+		back_index = ready.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// the newest frame if one was published since the last call, it stays valid until the next one that isn't null
+	const uint32_t* take() {
+		if (!(ready.load(std::memory_order_relaxed) & FRESH)) {
+			return nullptr;
+		}
+
+		front_index = ready.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+		return frames[front_index].data();
+	}
+
+private:
+	static constexpr uint8_t INDEX = 0b11;
+	// set while the buffer in ready hasn't been taken
+	static constexpr uint8_t FRESH = 0b100;
+
+	std::vector<uint32_t> frames[3];
+	uint8_t back_index {0};
+	uint8_t front_index {1};
+	alignas(64) std::atomic<uint8_t> ready {2};
+};
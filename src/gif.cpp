@@ -1,4 +1,5 @@
 #include <cassert>
+#include <algorithm>
 #include "gif.hpp"
 #include "bus.hpp"
 
@@ -10,86 +11,148 @@
 #define GIF_TAG_NREGS(packet) ((packet).low >> 60 & 0b1111)
 #define GIF_TAG_REG(packet, num) ((packet).high >> ((num) * 4))
 
-void Gif::fifo_write(Uint128 packet) {
-	if (data_remaining == 0) {
-		uint16_t nloop = GIF_TAG_NLOOP(packet);
-		if (nloop == 0) {
-			return;
-		}
-
-		bool eop = GIF_TAG_EOP(packet);
-		bool prim_en = GIF_TAG_PRIM_EN(packet);
-		uint16_t prim = GIF_TAG_PRIM(packet);
-		fmt = GIF_TAG_DATA_FMT(packet);
-		nregs = GIF_TAG_NREGS(packet);
-		if (nregs == 0) {
-			nregs = 16;
-		}
-
-		if (prim_en) {
-			bus.gs.prim = prim;
-		}
+size_t Gif::fifo_write(Uint128 packet, uint8_t path) {
+	return fifo_write(std::span<const Uint128> {&packet, 1}, path);
+}
 
-		regs_remaining = nregs;
-		data_remaining = nloop;
-		regs = packet.high;
-	}
-	else {
-		// PACKED
-		if (fmt == 0) {
-			uint8_t reg = regs >> ((nregs - regs_remaining) * 4) & 0b1111;
-			--regs_remaining;
-			if (regs_remaining == 0) {
-				regs_remaining = nregs;
-				--data_remaining;
+size_t Gif::fifo_write(std::span<const Uint128> data, uint8_t path) {
+	size_t i = 0;
+	while (i < data.size()) {
+		if (data_remaining == 0) {
+			if (!path_available(path)) {
+				break;
 			}
 
-			if (reg == 0) {
-				bus.gs.prim = packet.low & 0x7FF;
-			}
-			else if (reg == 1) {
-				bus.gs.rgbaq.red = packet.low & 0xFF;
-				bus.gs.rgbaq.green = packet.low >> 32 & 0xFF;
-				bus.gs.rgbaq.blue = packet.high & 0xFF;
-				bus.gs.rgbaq.alpha = packet.high >> 32 & 0xFF;
-			}
-			else if (reg == 4) {
-				// x
-				uint64_t data = packet.low & 0xFFFF;
-				// y
-				data |= (packet.low >> 32 & 0xFFFF) << 16;
-				// z
-				data |= (packet.high >> 4 & 0xFFFFFF) << 32;
-				// f
-				data |= (packet.high >> 36 & 0xFF) << 56;
-				// disable drawing
-				if (packet.high & 1ULL << 47) {
-					bus.gs.write_reg(0xC, data);
-				}
-				else {
-					bus.gs.write_reg(0x4, data);
+			const auto& packet = data[i++];
+			uint16_t nloop = GIF_TAG_NLOOP(packet);
+			eop = GIF_TAG_EOP(packet);
+			active_path = path;
+			if (nloop == 0) {
+				if (eop) {
+					active_path = 0;
 				}
+				continue;
 			}
-			else if (reg == 0xE) {
-				reg = packet.high & 0xFF;
-				bus.gs.write_reg(reg, packet.low);
+
+			bool prim_en = GIF_TAG_PRIM_EN(packet);
+			uint16_t prim = GIF_TAG_PRIM(packet);
+			fmt = GIF_TAG_DATA_FMT(packet);
+			nregs = GIF_TAG_NREGS(packet);
+			if (nregs == 0) {
+				nregs = 16;
 			}
-			else if (reg == 2 || reg == 3 || reg == 5 || reg == 0xA ||
-				reg == 0xF) {
-				assert(false && "unimplemented gs reg accessed");
+
+			if (prim_en) {
+				bus.gs.submit(0x00, prim);
 			}
-			else {
-				bus.gs.write_reg(reg, packet.low);
+
+			regs_remaining = nregs;
+			data_remaining = nloop;
+			regs = packet.high;
+		}
+		// PACKED
+		else if (fmt == 0) {
+			while (i < data.size() && data_remaining) {
+				uint8_t reg = regs >> ((nregs - regs_remaining) * 4) & 0b1111;
+				--regs_remaining;
+				if (regs_remaining == 0) {
+					regs_remaining = nregs;
+					--data_remaining;
+				}
+				write_packed(reg, data[i++]);
 			}
 		}
 		// IMAGE
 		else if (fmt == 2 || fmt == 3) {
-			bus.gs.write_hw_reg(packet.low);
-			bus.gs.write_hw_reg(packet.high);
-			--data_remaining;
+			size_t count = std::min<size_t>(data_remaining, data.size() - i);
+			bus.gs.submit_image(data.subspan(i, count));
+			i += count;
+			data_remaining -= count;
 		}
 		else {
 			assert(false);
 		}
+
+		// the path keeps the gif until the data of its packet's last tag is done
+		if (data_remaining == 0 && eop) {
+			active_path = 0;
+		}
+	}
+	return i;
+}
+
+void Gif::write_packed(uint8_t reg, const Uint128& packet) {
+	if (reg == 0) {
+		bus.gs.submit(0x00, packet.low & 0x7FF);
+	}
+	else if (reg == 1) {
+		uint64_t data = packet.low & 0xFF;
+		data |= (packet.low >> 32 & 0xFF) << 8;
+		data |= (packet.high & 0xFF) << 16;
+		data |= (packet.high >> 32 & 0xFF) << 24;
+		data |= static_cast<uint64_t>(q) << 32;
+		bus.gs.submit(0x01, data);
+	}
+	else if (reg == 2) {
+		// the q of ST is kept for the next PACKED RGBAQ
+		q = packet.high & 0xFFFFFFFF;
+		bus.gs.submit(0x02, packet.low);
+	}
+	else if (reg == 3) {
+		// u
+		uint64_t data = packet.low & 0x3FFF;
+		// v
+		data |= (packet.low >> 32 & 0x3FFF) << 16;
+		bus.gs.submit(0x03, data);
+	}
+	else if (reg == 4) {
+		// x
+		uint64_t data = packet.low & 0xFFFF;
+		// y
+		data |= (packet.low >> 32 & 0xFFFF) << 16;
+		// z
+		data |= (packet.high >> 4 & 0xFFFFFF) << 32;
+		// f
+		data |= (packet.high >> 36 & 0xFF) << 56;
+		// disable drawing
+		if (packet.high & 1ULL << 47) {
+			bus.gs.submit(0xC, data);
+		}
+		else {
+			bus.gs.submit(0x4, data);
+		}
+	}
+	else if (reg == 5) {
+		// x
+		uint64_t data = packet.low & 0xFFFF;
+		// y
+		data |= (packet.low >> 32 & 0xFFFF) << 16;
+		// z
+		data |= (packet.high & 0xFFFFFFFF) << 32;
+		// disable drawing
+		if (packet.high & 1ULL << 47) {
+			bus.gs.submit(0xD, data);
+		}
+		else {
+			bus.gs.submit(0x5, data);
+		}
+	}
+	// FOG
+	else if (reg == 0xA) {
+		bus.gs.submit(0x0A, (packet.high >> 36 & 0xFF) << 56);
+	}
+	// NOP
+	else if (reg == 0xF) {
+
+	}
+	else if (reg == 0xE) {
+		uint8_t addr = packet.high & 0xFF;
+		if (addr == 0x01) {
+			q = packet.low >> 32;
+		}
+		bus.gs.submit(addr, packet.low);
+	}
+	else {
+		bus.gs.submit(reg, packet.low);
 	}
 }
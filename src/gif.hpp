@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <span>
 #include "utils.hpp"
 
 struct Bus;
@@ -14,6 +15,27 @@ struct Gif {
 	uint8_t nregs;
 	uint8_t regs_remaining;
 	uint8_t fmt;
+	// the current tag is the last one of its packet
+	bool eop;
+	// the path whose packet the gif is in the middle of, 0 between packets
+	uint8_t active_path;
+	// VIF1 MSKPATH3, PATH3 can't start another packet while it's set
+	bool path3_masked;
+	// q of the last ST or RGBAQ write, PACKED RGBAQ writes only carry the color
+	uint32_t q {0x3F800000};
 
-	void fifo_write(Uint128 packet);
+	// a path can only start a packet once the packet of another path has ended
+	bool path_available(uint8_t path) const {
+		if (path == 3 && path3_masked && active_path != 3) {
+			return false;
+		}
+		return active_path == 0 || active_path == path;
+	}
+
+	// data of a path, returns the quadwords taken before another path's packet held it up
+	size_t fifo_write(Uint128 packet, uint8_t path);
+	size_t fifo_write(std::span<const Uint128> data, uint8_t path);
+
+private:
+	void write_packed(uint8_t reg, const Uint128& packet);
 };
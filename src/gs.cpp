@@ -1,8 +1,15 @@
 #include <cassert>
 #include <algorithm>
+#include <bit>
 #include "gs.hpp"
+#include "gs_swizzle.hpp"
+#include "gs_format.hpp"
+#include "bus.hpp"
 #include <SDL.h>
 
+#define GS_CMD_QUIT 0x100
+#define GS_CMD_FLUSH 0x101
+
 constexpr int VERTICES_IN_PRIM[] {
 	// point
 	1,
@@ -22,9 +29,26 @@ constexpr int VERTICES_IN_PRIM[] {
 	0
 };
 
+// RGBAQ, ST, UV, XYZF2, XYZ2, FOG, XYZF3, XYZ3
+static bool is_vertex_reg(uint8_t reg) {
+	return (reg >= 0x01 && reg <= 0x05) || reg == 0x0A || reg == 0x0C || reg == 0x0D;
+}
+
 void Gs::write_reg(uint8_t reg, uint64_t data) {
+	// everything besides vertex data and transfer data feeds the draw state
+	if (reg != 0x00 && !is_vertex_reg(reg) && reg != 0x54) {
+		draw_state.valid = false;
+	}
+
 	if (reg == 0x00) {
+		// GIF tags rewrite PRIM with the same value all the time
+		if ((data & 0x7FF) != prim) {
+			draw_state.valid = false;
+		}
 		prim = data & 0x7FF;
+		// a new prim starts with an empty vertex queue
+		vertex_count = 0;
+		vertex_next = 0;
 	}
 	else if (reg == 0x01) {
 		rgbaq.red = data & 0xFF;
@@ -33,65 +57,23 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		rgbaq.alpha = data >> 24 & 0xFF;
 		rgbaq.q = data >> 32;
 	}
-	else if (reg == 0x04) {
-		uint16_t x = data & 0xFFFF;
-		uint16_t y = data >> 16 & 0xFFFF;
-		uint32_t z = data >> 32 & 0xFFFFFF;
-		uint8_t f = data >> 56;
-
-		const auto& ctx = contexts[(prim & 1 << 9) ? 1 : 0];
-
-		vertex_queue[vertex_count++] = {
-			.x = static_cast<uint16_t>(x - ctx.x_off),
-			.y = static_cast<uint16_t>(y - ctx.y_off),
-			.z = z,
-			.r = rgbaq.red,
-			.g = rgbaq.green,
-			.b = rgbaq.blue,
-			.a = rgbaq.alpha
-		};
-
-		auto needed = VERTICES_IN_PRIM[prim & 0b111];
-		if (vertex_count == needed) {
-			auto type = prim & 0b111;
-			if (type == 3) {
-				draw_triangle();
-			}
-			else if (type == 6) {
-				draw_sprite();
-			}
-			else {
-				assert(false);
-			}
-		}
+	// ST
+	else if (reg == 0x02) {
+		st.s = std::bit_cast<float>(static_cast<uint32_t>(data));
+		st.t = std::bit_cast<float>(static_cast<uint32_t>(data >> 32));
 	}
-	else if (reg == 0x05) {
-		uint16_t x = data & 0xFFFF;
-		uint16_t y = data >> 16 & 0xFFFF;
-		uint16_t z = data >> 32;
-
-		const auto& ctx = contexts[(prim & 1 << 9) ? 1 : 0];
-
-		vertex_queue[vertex_count++] = {
-			.x = static_cast<uint16_t>(x - ctx.x_off),
-			.y = static_cast<uint16_t>(y - ctx.y_off),
-			.z = z,
-			.r = rgbaq.red,
-			.g = rgbaq.green,
-			.b = rgbaq.blue,
-			.a = rgbaq.alpha
-		};
-
-		auto needed = VERTICES_IN_PRIM[prim & 0b111];
-		if (vertex_count == needed) {
-			auto type = prim & 0b111;
-			if (type == 6) {
-				draw_sprite();
-			}
-			else {
-				assert(false);
-			}
-		}
+	// UV
+	else if (reg == 0x03) {
+		uv.u = data & 0x3FFF;
+		uv.v = data >> 16 & 0x3FFF;
+	}
+	// XYZF2, XYZF3
+	else if (reg == 0x04 || reg == 0x0C) {
+		kick_vertex(data & 0xFFFF, data >> 16 & 0xFFFF, data >> 32 & 0xFFFFFF, data >> 56, reg == 0x04);
+	}
+	// XYZ2, XYZ3
+	else if (reg == 0x05 || reg == 0x0D) {
+		kick_vertex(data & 0xFFFF, data >> 16 & 0xFFFF, data >> 32, fog, reg == 0x05);
 	}
 	else if (reg == 0x06) {
 		contexts[0].tex.base_ptr = data & 0x3FFF;
@@ -103,8 +85,10 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		contexts[0].tex.color_func = data >> 35 & 0b11;
 		contexts[0].tex.clut_base_ptr = data >> 37 & 0x3FFF;
 		contexts[0].tex.clut_fmt = data >> 51 & 0xF;
+		contexts[0].tex.clut_csm2 = data >> 55 & 1;
 		contexts[0].tex.clut_entry_off = data >> 56 & 0x1F;
 		contexts[0].tex.clut_cache_ctrl = data >> 61;
+		update_clut(contexts[0]);
 	}
 	else if (reg == 0x07) {
 		contexts[1].tex.base_ptr = data & 0x3FFF;
@@ -116,8 +100,10 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		contexts[1].tex.color_func = data >> 35 & 0b11;
 		contexts[1].tex.clut_base_ptr = data >> 37 & 0x3FFF;
 		contexts[1].tex.clut_fmt = data >> 51 & 0xF;
+		contexts[1].tex.clut_csm2 = data >> 55 & 1;
 		contexts[1].tex.clut_entry_off = data >> 56 & 0x1F;
 		contexts[1].tex.clut_cache_ctrl = data >> 61;
+		update_clut(contexts[1]);
 	}
 	else if (reg == 0x08) {
 		contexts[0].tex_wrap_mode.hz_wrap_mode = data & 0b11;
@@ -135,6 +121,33 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		contexts[1].tex_wrap_mode.v_clamp_min = data >> 24 & 0x3FF;
 		contexts[1].tex_wrap_mode.v_clamp_max = data >> 34 & 0x3FF;
 	}
+	// FOG
+	else if (reg == 0x0A) {
+		fog = data >> 56;
+	}
+	// TEX2_1, TEX2_2, the clut half of TEX0
+	else if (reg == 0x16 || reg == 0x17) {
+		auto& tex = contexts[reg - 0x16].tex;
+		tex.fmt = data >> 20 & 0x3F;
+		tex.clut_base_ptr = data >> 37 & 0x3FFF;
+		tex.clut_fmt = data >> 51 & 0xF;
+		tex.clut_csm2 = data >> 55 & 1;
+		tex.clut_entry_off = data >> 56 & 0x1F;
+		tex.clut_cache_ctrl = data >> 61;
+		update_clut(contexts[reg - 0x16]);
+	}
+	// TEXCLUT
+	else if (reg == 0x1C) {
+		texclut.cbw = data & 0x3F;
+		texclut.cou = data >> 6 & 0x3F;
+		texclut.cov = data >> 12 & 0x3FF;
+	}
+	// TEX1_1, TEX1_2
+	else if (reg == 0x14 || reg == 0x15) {
+		auto& tex_filter = contexts[reg - 0x14].tex_filter;
+		tex_filter.mag_filter = data >> 5 & 1;
+		tex_filter.min_filter = data >> 6 & 0b111;
+	}
 	else if (reg == 0x18) {
 		contexts[0].x_off = data & 0xFFFF;
 		contexts[0].y_off = data >> 32 & 0xFFFF;
@@ -148,6 +161,35 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		contexts[0].scissor.y0 = data >> 32 & 0x7FF;
 		contexts[0].scissor.y1 = data >> 48 & 0x7FF;
 	}
+	// TEXA
+	else if (reg == 0x3B) {
+		texa.ta0 = data & 0xFF;
+		texa.aem = data >> 15 & 1;
+		texa.ta1 = data >> 32 & 0xFF;
+	}
+	// FOGCOL
+	else if (reg == 0x3D) {
+		fog_color = data & 0xFFFFFF;
+	}
+	// ALPHA_1, ALPHA_2
+	else if (reg == 0x42 || reg == 0x43) {
+		auto& alpha = contexts[reg - 0x42].alpha;
+		alpha.a = data & 0b11;
+		alpha.b = data >> 2 & 0b11;
+		alpha.c = data >> 4 & 0b11;
+		alpha.d = data >> 6 & 0b11;
+		alpha.fix = data >> 32 & 0xFF;
+	}
+	// DIMX
+	else if (reg == 0x44) {
+		for (int y = 0; y < 4; ++y) {
+			for (int x = 0; x < 4; ++x) {
+				// 3-bit signed entries
+				auto entry = static_cast<int8_t>((data >> (y * 16 + x * 4) & 0b111) << 5);
+				dimx[y][x] = entry >> 5;
+			}
+		}
+	}
 	else if (reg == 0x45) {
 		dither = data & 1;
 	}
@@ -158,12 +200,20 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		contexts[0].test.alpha_test_enabled = data & 1;
 		contexts[0].test.alpha_test_method = data >> 1 & 0b111;
 		contexts[0].test.alpha_ref = data >> 4 & 0xFF;
-		contexts[0].test.alpha_test_fail_processing = data >> 11 & 0b11;
+		contexts[0].test.alpha_test_fail_processing = data >> 12 & 0b11;
 		contexts[0].test.dest_alpha_test_enabled = data & 1U << 14;
 		contexts[0].test.dest_alpha_test_method = data >> 15 & 1;
 		contexts[0].test.depth_test_enabled = data & 1U << 16;
 		contexts[0].test.depth_test_method = data >> 17 & 0b11;
 	}
+	// PABE
+	else if (reg == 0x49) {
+		pabe = data & 1;
+	}
+	// FBA_1, FBA_2
+	else if (reg == 0x4A || reg == 0x4B) {
+		contexts[reg - 0x4A].fba = data & 1;
+	}
 	else if (reg == 0x4C) {
 		contexts[0].frame.base_ptr = data & 0x1FF;
 		contexts[0].frame.buf_width = data >> 16 & 0x3F;
@@ -195,257 +245,409 @@ void Gs::write_reg(uint8_t reg, uint64_t data) {
 		transfer.transfer_area_height = data >> 32 & 0xFFF;
 	}
 	else if (reg == 0x53) {
+		flush();
 		transfer.transfer_dir = data & 0b11;
+		if (transfer.transfer_dir == 0 || transfer.transfer_dir == 2) {
+			GsPageSet pages;
+			gs_mark_pages(pages, transfer.dest_fmt, transfer.dest_base_ptr, transfer.dest_buf_width,
+				transfer.dest_rect_x, transfer.dest_rect_y,
+				transfer.dest_rect_x + transfer.transfer_area_width - 1,
+				transfer.dest_rect_y + transfer.transfer_area_height - 1);
+			vram_dirty |= pages;
+			hiz.invalidate(pages);
+		}
 		if (transfer.transfer_dir == 2) {
-			transfer.transfer_dir = 3;
-			transfer.cur_src_x = transfer.src_rect_x;
-			transfer.cur_src_y = transfer.src_rect_y;
-			transfer.cur_dest_x = transfer.dest_rect_x;
-			transfer.cur_dest_y = transfer.dest_rect_y;
-
-			while (true) {
-				uint16_t src_base_ptr = transfer.src_base_ptr * 4 * 64;
-				uint16_t src_buf_width_px = transfer.src_buf_width * 64;
-				uint8_t src_fmt = transfer.src_fmt;
-				uint16_t dest_base_ptr = transfer.dest_base_ptr * 4 * 64;
-				uint16_t dest_buf_width_px = transfer.dest_buf_width * 64;
-				uint8_t dest_fmt = transfer.dest_fmt;
-				assert(src_fmt == 0);
-				assert(dest_fmt == 0);
-
-				auto width = transfer.transfer_area_width;
-				auto height = transfer.transfer_area_height;
-
-				uint8_t* dest_ptr_u8 = vram.data() + dest_base_ptr;
-				dest_ptr_u8 += transfer.cur_dest_y * dest_buf_width_px * 4;
-				dest_ptr_u8 += transfer.cur_dest_x * 4;
-				auto* dest_ptr = reinterpret_cast<uint32_t*>(dest_ptr_u8);
-
-				uint8_t* src_ptr_u8 = vram.data() + src_base_ptr;
-				src_ptr_u8 += transfer.cur_src_y * src_buf_width_px * 4;
-				src_ptr_u8 += transfer.cur_src_x * 4;
-				auto* src_ptr = reinterpret_cast<uint32_t*>(src_ptr_u8);
-
-				*dest_ptr = *src_ptr;
-				transfer.cur_dest_x += 1;
-				transfer.cur_src_x += 1;
-				// dest
-				if (transfer.cur_dest_x == 2048) {
-					transfer.cur_dest_x = 0;
-				}
-				else if (transfer.cur_dest_x >= transfer.dest_rect_x + width) {
-					transfer.cur_dest_x = transfer.dest_rect_x;
-					transfer.cur_dest_y += 1;
-					if (transfer.cur_dest_y == 2048) {
-						transfer.cur_dest_y = 0;
-					}
-					else if (transfer.cur_dest_y >= transfer.dest_rect_y + height) {
-						transfer.in_progress = false;
-						return;
-					}
-				}
-				// src
-				if (transfer.cur_src_x == 2048) {
-					transfer.cur_src_x = 0;
-				}
-				else if (transfer.cur_src_x >= transfer.src_rect_x + width) {
-					transfer.cur_src_x = transfer.src_rect_x;
-					transfer.cur_src_y += 1;
-					if (transfer.cur_src_y == 2048) {
-						transfer.cur_src_y = 0;
-					}
-					else if (transfer.cur_src_y >= transfer.src_rect_y + height) {
-						return;
-					}
-				}
-			}
+			copy_local_to_local();
+			transfer.in_progress = false;
 		}
 		else if (transfer.transfer_dir == 1) {
-			assert(false);
+			copy_local_to_host();
+			transfer.in_progress = false;
 		}
-
-		if (transfer.transfer_dir != 3) {
-			transfer.in_progress = true;
-			transfer.cur_src_x = transfer.src_rect_x;
-			transfer.cur_src_y = transfer.src_rect_y;
-			transfer.cur_dest_x = transfer.dest_rect_x;
-			transfer.cur_dest_y = transfer.dest_rect_y;
+		else if (transfer.transfer_dir == 0) {
+			transfer.in_progress = transfer.transfer_area_width && transfer.transfer_area_height;
+			transfer.area_x = 0;
+			transfer.area_y = 0;
+			transfer.carry = 0;
+			transfer.carry_bytes = 0;
 		}
 		else {
 			transfer.in_progress = false;
 		}
 	}
+	else if (reg == 0x54) {
+		flush();
+		write_hw_reg(data);
+	}
+	// SIGNAL
+	else if (reg == 0x60) {
+		uint32_t mask = data >> 32;
+		siglblid = (siglblid & ~static_cast<uint64_t>(mask)) | (data & mask);
+		csr |= 1U << 0;
+		if (!(imr & 1U << 8)) {
+			bus.ee_cpu.raise_int0(0);
+		}
+	}
+	// FINISH
+	else if (reg == 0x61) {
+		flush();
+		csr |= 1U << 1;
+		if (!(imr & 1U << 9)) {
+			bus.ee_cpu.raise_int0(0);
+		}
+	}
+	// LABEL
+	else if (reg == 0x62) {
+		uint64_t mask = data >> 32 << 32;
+		siglblid = (siglblid & ~mask) | (data << 32 & mask);
+	}
 	else {
 		assert(false);
 	}
 }
 
-void Gs::draw_pixel(uint16_t x, uint16_t y, uint32_t z, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+void Gs::write_csr(uint64_t value) {
+	csr = (csr & GS_CSR_EVENTS & ~value) | (value & ~GS_CSR_EVENTS);
+}
+
+void Gs::kick_vertex(uint16_t x, uint16_t y, uint32_t z, uint8_t f, bool draw) {
 	const auto& ctx = contexts[(prim & 1 << 9) ? 1 : 0];
-	if (x < ctx.scissor.x0 || x > ctx.scissor.x1 ||
-		y < ctx.scissor.y0 || y > ctx.scissor.y1) {
+	uint8_t type = prim & 0b111;
+	uint8_t slot = vertex_next;
+	vertex_queue[slot] = {
+		.x = x - ctx.x_off,
+		.y = y - ctx.y_off,
+		.z = z,
+		.fog = f,
+		.r = rgbaq.red,
+		.g = rgbaq.green,
+		.b = rgbaq.blue,
+		.a = rgbaq.alpha,
+		.u = uv.u,
+		.v = uv.v,
+		.s = st.s,
+		.t = st.t,
+		.q = std::bit_cast<float>(rgbaq.q)
+	};
+	// triangle fan
+	if (type == 5) {
+		vertex_next = slot == 2 ? 1 : slot + 1;
+	}
+	else {
+		vertex_next = (slot + 1) % 3;
+	}
+
+	auto needed = VERTICES_IN_PRIM[type];
+	if (++vertex_count < needed) {
+		return;
+	}
+	// reserved
+	if (type == 7) {
+		vertex_count = 0;
 		return;
 	}
 
-	assert(ctx.frame.fmt == 0);
-	auto fb_base_ptr = ctx.frame.base_ptr * 4 * 2048;
-	auto fb_width = ctx.frame.buf_width * 64;
+	if (draw) {
+		// the prim's vertices in the order they were kicked, the newest last
+		Vertex vertices[3];
+		if (type == 5) {
+			vertices[0] = vertex_queue[0];
+			vertices[1] = vertex_queue[slot == 1 ? 2 : 1];
+			vertices[2] = vertex_queue[slot];
+		}
+		else {
+			for (int i = 0; i < needed; ++i) {
+				vertices[i] = vertex_queue[(slot + 3 - (needed - 1) + i) % 3];
+			}
+		}
+		// strips and fans draw the same prims as their list types
+		constexpr uint8_t DRAW_TYPES[] {0, 1, 1, 3, 3, 3, 6};
+		queue_prim(DRAW_TYPES[type], vertices);
+	}
 
-	auto z_buf_base_ptr = ctx.z_buf.base_ptr * 4 * 2048;
-	uint32_t z_value;
-	if (ctx.z_buf.fmt == 0) {
-		z_value = *(uint32_t*) &vram[z_buf_base_ptr + y * fb_width * 4 + x * 4];
+	// strips and fans keep their last vertices for the next kick
+	if (type == 2 || type == 4 || type == 5) {
+		vertex_count = needed - 1;
 	}
 	else {
-		assert(false);
+		vertex_count = 0;
+		vertex_next = 0;
 	}
+}
 
-	if (ctx.test.depth_test_method == 0) {
-		return;
+Gs::~Gs() {
+	if (thread.joinable()) {
+		ring.push({0, GS_CMD_QUIT});
+		thread.join();
 	}
-	else if (ctx.test.depth_test_method == 2 || ctx.test.depth_test_method == 3) {
-		if ((ctx.test.depth_test_method == 2 && z < z_value) ||
-			(ctx.test.depth_test_method == 3 && z <= z_value)) {
-			return;
-		}
+}
+
+void Gs::start_thread() {
+	threaded = true;
+	thread = std::thread {[this]() {
+		thread_main();
+	}};
+}
+
+void Gs::submit(uint16_t reg, uint64_t data) {
+	if (!threaded) {
+		write_reg(reg, data);
+		return;
 	}
 
-	if (!ctx.z_buf.buf_mask) {
-		*(uint32_t*) &vram[z_buf_base_ptr + y * fb_width * 4 + x * 4] = z;
+	// writes with effects the ee can observe run on the ee thread once the gs thread is idle
+	if (reg == 0x60 || reg == 0x61 || reg == 0x62 || (reg == 0x53 && (data & 0b11) == 1)) {
+		sync();
+		write_reg(reg, data);
+		return;
 	}
 
-	auto* ptr = (uint32_t*) &vram[fb_base_ptr + y * fb_width * 4 + x * 4];
-	uint32_t value = a << 24 | b << 16 | g << 8 | r;
-	*ptr = value;
+	ring.push({data, reg});
+	++submitted;
 }
 
-void Gs::draw_sprite() {
-	auto first = vertex_queue[0];
-	auto second = vertex_queue[1];
-	vertex_count = 0;
+void Gs::submit_image(std::span<const Uint128> data) {
+	if (!threaded) {
+		flush();
+		write_image(&data.data()->low, data.size() * 2);
+		return;
+	}
+
+	// the gs thread hands runs of these to write_image in one go
+	for (const auto& packet : data) {
+		ring.push({packet.low, 0x54});
+		ring.push({packet.high, 0x54});
+	}
+	submitted += data.size() * 2;
+}
 
-	assert(second.x > first.x);
-	assert(second.y > first.y);
+void Gs::sync() {
+	if (!threaded) {
+		flush();
+		return;
+	}
 
-	first.x /= 16;
-	first.y /= 16;
-	second.x /= 16;
-	second.y /= 16;
+	ring.push({0, GS_CMD_FLUSH});
+	++submitted;
 
-	for (uint16_t y = first.y; y < second.y; ++y) {
-		for (uint16_t x = first.x; x < second.x; ++x) {
-			draw_pixel(x, y, first.z, first.r, first.g, first.b, first.a);
+	while (true) {
+		auto done = completed.load(std::memory_order_acquire);
+		if (done == submitted) {
+			break;
 		}
+		completed.wait(done, std::memory_order_acquire);
 	}
 }
 
-int orient_2d(const Gs::Vertex& a, const Gs::Vertex& b, const Gs::Vertex& c) {
-	return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
-}
+void Gs::thread_main() {
+	uint64_t done = 0;
+	Command cmd {};
+	auto write_image_batch = [this]() {
+		if (!image_batch.empty()) {
+			flush();
+			write_image(image_batch.data(), image_batch.size());
+			image_batch.clear();
+		}
+	};
+
+	while (true) {
+		if (!ring.pop(cmd)) {
+			write_image_batch();
+			completed.store(done, std::memory_order_release);
+			completed.notify_one();
+			ring.wait_for_data();
+			continue;
+		}
 
-void Gs::draw_triangle() {
-	auto first = vertex_queue[0];
-	auto second = vertex_queue[1];
-	auto third = vertex_queue[2];
-	vertex_count = 0;
-
-	first.x /= 16;
-	first.y /= 16;
-	second.x /= 16;
-	second.y /= 16;
-	third.x /= 16;
-	third.y /= 16;
-
-	// if the vertices is in ccw order flip them
-	if (orient_2d(first, second, third) < 0) {
-		std::swap(second, third);
-	}
-
-	auto left_bottom_x = std::min({first.x, second.x, third.x});
-	auto left_bottom_y = std::min({first.y, second.y, third.y});
-	auto right_top_x = std::max({first.x, second.x, third.x});
-	auto right_top_y = std::max({first.y, second.y, third.y});
-
-	auto area = static_cast<float>(orient_2d(first, second, third));
-
-	for (uint16_t y = left_bottom_y; y <= right_top_y; ++y) {
-		for (uint16_t x = left_bottom_x; x <= right_top_x; ++x) {
-			Vertex point {
-				.x = x,
-				.y = y
-			};
-			int w0 = orient_2d(second, third, point);
-			int w1 = orient_2d(third, first, point);
-			int w2 = orient_2d(first, second, point);
-			if (w0 >= 0 && w1 >= 0 && w2 >= 0) {
-				auto z = static_cast<float>(first.z * w0 + second.z * w1 + third.z * w2);
-				z /= area;
-				int r = static_cast<int>(static_cast<float>(first.r * w0 + second.r * w1 + third.r * w2) / area);
-				int g = static_cast<int>(static_cast<float>(first.g * w0 + second.g * w1 + third.g * w2) / area);
-				int b = static_cast<int>(static_cast<float>(first.b * w0 + second.b * w1 + third.b * w2) / area);
-				int a = static_cast<int>(static_cast<float>(first.a * w0 + second.a * w1 + third.a * w2) / area);
-				draw_pixel(x, y, (uint32_t) z, r, g, b, a);
-			}
+		if (cmd.reg == 0x54) {
+			image_batch.push_back(cmd.data);
+			++done;
+			continue;
 		}
+		write_image_batch();
+
+		if (cmd.reg == GS_CMD_QUIT) {
+			break;
+		}
+		else if (cmd.reg == GS_CMD_FLUSH) {
+			flush();
+		}
+		else {
+			write_reg(cmd.reg, cmd.data);
+		}
+		++done;
 	}
 }
 
 void Gs::write_hw_reg(uint64_t data) {
+	write_image(&data, 1);
+}
+
+void Gs::write_image(const uint64_t* words, size_t count) {
 	if (!transfer.in_progress) {
-		assert(false && "write_hw_reg called while transfer was not in progress");
+		assert(false && "write_image called while transfer was not in progress");
 	}
 	// GIF->VRAM
-	if (transfer.transfer_dir == 0) {
-		uint8_t src_fmt = transfer.src_fmt;
-		uint16_t dest_base_ptr = transfer.dest_base_ptr * 4 * 64;
-		uint16_t dest_buf_width_px = transfer.dest_buf_width * 64;
-		uint8_t dest_fmt = transfer.dest_fmt;
-		assert(src_fmt == 0);
-		assert(dest_fmt == 0);
-
-		auto width = transfer.transfer_area_width;
-		auto height = transfer.transfer_area_height;
-
-		uint8_t* dest_ptr = vram.data() + dest_base_ptr;
-		dest_ptr += transfer.cur_dest_y * dest_buf_width_px * 4;
-		dest_ptr += transfer.cur_dest_x * 4;
-		auto* ptr = reinterpret_cast<uint32_t*>(dest_ptr);
-
-		*ptr++ = data;
-		transfer.cur_dest_x += 1;
-		if (transfer.cur_dest_x == 2048) {
-			transfer.cur_dest_x = 0;
+	if (transfer.transfer_dir != 0) {
+		assert(false);
+	}
+
+	uint8_t psm = transfer.dest_fmt;
+	auto field = gs_psm_field(psm);
+	bool bits24 = psm == GS_PSMCT24 || psm == GS_PSMZ24;
+	// host data is packed at the size the format takes up in vram, T8H and T4HL/HH included
+	uint32_t bits = bits24 ? 24 : std::popcount(field.mask);
+
+	image_pixels.clear();
+	if (bits24) {
+		auto* bytes = reinterpret_cast<const uint8_t*>(words);
+		for (size_t i = 0; i < count * 8; ++i) {
+			transfer.carry |= bytes[i] << (transfer.carry_bytes * 8);
+			if (++transfer.carry_bytes == 3) {
+				image_pixels.push_back(transfer.carry);
+				transfer.carry = 0;
+				transfer.carry_bytes = 0;
+			}
 		}
-		else if (transfer.cur_dest_x >= transfer.dest_rect_x + width) {
-			transfer.cur_dest_x = transfer.dest_rect_x;
-			transfer.cur_dest_y += 1;
-			if (transfer.cur_dest_y == 2048) {
-				transfer.cur_dest_y = 0;
+	}
+	else {
+		uint32_t per_word = 64 / bits;
+		uint64_t mask = (1ULL << bits) - 1;
+		image_pixels.resize(count * per_word);
+		for (size_t i = 0; i < count; ++i) {
+			for (uint32_t j = 0; j < per_word; ++j) {
+				image_pixels[i * per_word + j] = words[i] >> (j * bits) & mask;
 			}
-			else if (transfer.cur_dest_y >= transfer.dest_rect_y + height) {
-				transfer.in_progress = false;
-				return;
+		}
+		if (field.color16) {
+			// the span writes pack colors from 32 bits
+			for (auto& pixel : image_pixels) {
+				pixel = gs_expand16(pixel);
 			}
 		}
+	}
 
-		*ptr = data >> 32;
-		transfer.cur_dest_x += 1;
-		if (transfer.cur_dest_x == 2048) {
-			transfer.cur_dest_x = 0;
+	write_image_pixels(image_pixels.data(), image_pixels.size());
+}
+
+namespace {
+	// calls fn(x, offset, length) for the pieces of a row of width pixels from x between the 2048 wrap points
+	template<typename F>
+	void for_row_segments(uint32_t x, uint32_t width, F&& fn) {
+		for (uint32_t done = 0; done < width;) {
+			uint32_t start = (x + done) & 2047;
+			uint32_t length = std::min(width - done, 2048 - start);
+			fn(start, done, length);
+			done += length;
 		}
-		else if (transfer.cur_dest_x >= transfer.dest_rect_x + width) {
-			transfer.cur_dest_x = transfer.dest_rect_x;
-			transfer.cur_dest_y += 1;
-			if (transfer.cur_dest_y == 2048) {
-				transfer.cur_dest_y = 0;
+	}
+}
+
+void Gs::copy_local_to_local() {
+	uint32_t width = transfer.transfer_area_width;
+	uint32_t height = transfer.transfer_area_height;
+	auto src = gs_psm_field(transfer.src_fmt);
+	auto dest = gs_psm_field(transfer.dest_fmt);
+	// 16-bit colors are read as 32 bits, other 16-bit formats stay raw values
+	bool pack = src.color16 && !dest.color16 && dest.mask == 0xFFFF;
+	bool expand = !src.color16 && src.mask == 0xFFFF && dest.color16;
+
+	// rows are staged whole so a row overlapping itself copies like memmove, DIR bit 0 walks them bottom up
+	bool bottom_up = transfer.transmission_order & 1;
+	image_pixels.resize(width);
+	uint32_t* row = image_pixels.data();
+	for (uint32_t i = 0; i < height; ++i) {
+		uint32_t area_y = bottom_up ? height - 1 - i : i;
+		uint32_t src_y = (transfer.src_rect_y + area_y) & 2047;
+		uint32_t dest_y = (transfer.dest_rect_y + area_y) & 2047;
+
+		for_row_segments(transfer.src_rect_x, width, [&](uint32_t x, uint32_t offset, uint32_t length) {
+			gs_read_span(vram.data(), transfer.src_fmt, transfer.src_base_ptr, transfer.src_buf_width, x, src_y, length, row + offset);
+		});
+		if (pack || expand) {
+			for (uint32_t x = 0; x < width; ++x) {
+				row[x] = pack ? gs_pack16(row[x]) : gs_expand16(row[x]);
 			}
-			else if (transfer.cur_dest_y >= transfer.dest_rect_y + height) {
-				transfer.in_progress = false;
-				return;
+		}
+		for_row_segments(transfer.dest_rect_x, width, [&](uint32_t x, uint32_t offset, uint32_t length) {
+			gs_write_span(vram.data(), transfer.dest_fmt, transfer.dest_base_ptr, transfer.dest_buf_width, x, dest_y, length, row + offset);
+		});
+	}
+}
+
+void Gs::copy_local_to_host() {
+	uint32_t width = transfer.transfer_area_width;
+	uint32_t height = transfer.transfer_area_height;
+	uint8_t psm = transfer.src_fmt;
+	auto field = gs_psm_field(psm);
+	bool bits24 = psm == GS_PSMCT24 || psm == GS_PSMZ24;
+	uint32_t bits = bits24 ? 24 : std::popcount(field.mask);
+
+	// the whole transfer is produced here so the gs thread is only synced once, when TRXDIR is written
+	readback.clear();
+	readback.reserve((static_cast<size_t>(width) * height * bits + 127) / 128 * 2);
+	readback_pos = 0;
+	image_pixels.resize(width);
+	uint32_t* row = image_pixels.data();
+	uint64_t word = 0;
+	uint32_t word_bits = 0;
+	for (uint32_t i = 0; i < height; ++i) {
+		uint32_t y = (transfer.src_rect_y + i) & 2047;
+		for_row_segments(transfer.src_rect_x, width, [&](uint32_t x, uint32_t offset, uint32_t length) {
+			gs_read_span(vram.data(), psm, transfer.src_base_ptr, transfer.src_buf_width, x, y, length, row + offset);
+		});
+
+		// packed the same way as host->local data, pixels can straddle words
+		for (uint32_t x = 0; x < width; ++x) {
+			uint64_t value = field.color16 ? gs_pack16(row[x]) : row[x] & ((1ULL << bits) - 1);
+			word |= value << word_bits;
+			word_bits += bits;
+			if (word_bits >= 64) {
+				readback.push_back(word);
+				word_bits -= 64;
+				word = word_bits ? value >> (bits - word_bits) : 0;
 			}
 		}
 	}
-	else {
-		assert(false);
+	if (word_bits) {
+		readback.push_back(word);
+	}
+	// the fifo hands out whole quadwords
+	if (readback.size() & 1) {
+		readback.push_back(0);
+	}
+}
+
+uint64_t Gs::read_fifo(bool high) {
+	if (readback_pos >= readback.size()) {
+		return 0;
+	}
+	uint64_t value = readback[readback_pos + high];
+	if (high) {
+		readback_pos += 2;
+	}
+	return value;
+}
+
+void Gs::write_image_pixels(const uint32_t* pixels, size_t count) {
+	// TRXPOS.DIR only applies to local->local copies, host data always fills rows top to bottom
+	auto width = transfer.transfer_area_width;
+	auto height = transfer.transfer_area_height;
+	size_t i = 0;
+	while (i < count && transfer.in_progress) {
+		// rows wrap around at 2048, a segment ends at the row end or the wrap point
+		uint32_t x = (transfer.dest_rect_x + transfer.area_x) & 2047;
+		uint32_t y = (transfer.dest_rect_y + transfer.area_y) & 2047;
+		uint32_t length = std::min<size_t>({count - i, static_cast<size_t>(width - transfer.area_x), 2048 - x});
+		gs_write_span(vram.data(), transfer.dest_fmt, transfer.dest_base_ptr, transfer.dest_buf_width, x, y, length, pixels + i);
+		i += length;
+
+		transfer.area_x += length;
+		if (transfer.area_x == width) {
+			transfer.area_x = 0;
+			if (++transfer.area_y == height) {
+				transfer.in_progress = false;
+			}
+		}
 	}
 }
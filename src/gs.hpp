@@ -1,18 +1,40 @@
 #pragma once
 #include <cstdint>
 #include "utils.hpp"
+#include "spsc_ring.hpp"
+#include "thread_pool.hpp"
+#include "gs_jit.hpp"
+#include "gs_texture.hpp"
+#include "gs_hiz.hpp"
 #include <vector>
+#include <span>
+#include <atomic>
+#include <thread>
+#include <algorithm>
 
 struct Bus;
 
+#define GS_TILE_SIZE 32
+#define GS_TILES_X (2048 / GS_TILE_SIZE)
+#define GS_TILES_Y (2048 / GS_TILE_SIZE)
+// prims queued before the bins are flushed even without a state change
+#define GS_MAX_BATCH_PRIMS 4096
+// CSR SIGNAL, FINISH, HSINT, VSINT and EDWINT, the ee clears them by writing 1
+#define GS_CSR_EVENTS 0x1FULL
+
 struct Gs {
 	Bus& bus;
-	uint32_t* target;
 	uint64_t pmode;
+	uint64_t smode2;
+	uint64_t dispfb1;
+	uint64_t display1;
 	uint64_t dispfb2;
 	uint64_t display2;
+	uint64_t bgcolor;
 	uint64_t csr;
 	uint64_t imr;
+	uint64_t siglblid;
+	uint64_t busdir;
 
 	uint16_t prim;
 
@@ -24,9 +46,37 @@ struct Gs {
 		uint32_t q;
 	} rgbaq;
 
+	struct {
+		float s;
+		float t;
+	} st;
+
+	struct {
+		uint16_t u;
+		uint16_t v;
+	} uv;
+
+	// alpha of texels from formats without a full alpha channel
+	struct {
+		uint8_t ta0;
+		bool aem;
+		uint8_t ta1;
+	} texa;
+
 	bool prmodecont;
 	bool signed_clamp;
 	bool dither;
+	bool pabe;
+	int8_t dimx[4][4];
+	uint32_t fog_color;
+	// fog of the next vertex kicked without one of its own
+	uint8_t fog;
+
+	struct {
+		uint8_t cbw;
+		uint8_t cou;
+		uint16_t cov;
+	} texclut;
 
 	struct Context {
 		uint16_t x_off;
@@ -86,6 +136,22 @@ struct Gs {
 			uint8_t clut_entry_off;
 			uint8_t clut_cache_ctrl;
 		} tex;
+
+		// only nearest sampling of the base level is implemented
+		struct {
+			uint8_t mag_filter;
+			uint8_t min_filter;
+		} tex_filter;
+
+		struct {
+			uint8_t a;
+			uint8_t b;
+			uint8_t c;
+			uint8_t d;
+			uint8_t fix;
+		} alpha;
+
+		bool fba;
 	} contexts[2];
 
 	struct {
@@ -105,35 +171,240 @@ struct Gs {
 		uint16_t transfer_area_width;
 		uint16_t transfer_area_height;
 		uint8_t transfer_dir;
-
-		uint16_t cur_src_x;
-		uint16_t cur_src_y;
-		uint16_t cur_dest_x;
-		uint16_t cur_dest_y;
 		bool in_progress;
+
+		// pixels done of the current row and rows done of a host transfer
+		uint16_t area_x;
+		uint16_t area_y;
+		// bytes of a 24-bit pixel split across host words
+		uint32_t carry;
+		uint8_t carry_bytes;
 	} transfer;
 
+	// host data unpacked to one pixel per word
+	std::vector<uint32_t> image_pixels;
+	// HWREG writes the gs thread collected from consecutive commands
+	std::vector<uint64_t> image_batch;
+	// a local->host transfer packed as host data, read by the ee through the gif fifo
+	std::vector<uint64_t> readback;
+	size_t readback_pos {};
+
 	void write_reg(uint8_t reg, uint64_t data);
 	void write_hw_reg(uint64_t data);
+	// IMAGE data of a host->local transfer, any number of 64-bit words
+	void write_image(const uint64_t* words, size_t count);
+	void write_image_pixels(const uint32_t* pixels, size_t count);
+	void copy_local_to_local();
+	void copy_local_to_host();
+	// the low or high half of the quadword at the head of the readback data, reading the high half pops it
+	uint64_t read_fifo(bool high);
+
+	// register writes queued for the gs thread when it is enabled
+	struct Command {
+		uint64_t data;
+		uint16_t reg;
+	};
+	SpscRing<Command> ring {1 << 16};
+	std::thread thread;
+	bool threaded {};
+	uint64_t submitted {};
+	std::atomic<uint64_t> completed {};
+
+	~Gs();
+	void start_thread();
+	void submit(uint16_t reg, uint64_t data);
+	void submit_image(std::span<const Uint128> data);
+	void sync();
+	void thread_main();
+	// an ee write to CSR, event bits written as 1 are cleared and the rest is stored
+	void write_csr(uint64_t value);
+
+	// merges what the read circuits display into SCREEN_HEIGHT rows of ABGR8888 pitch bytes apart,
+	// the current field of it when interlaced
+	void read_output(uint32_t* out, int pitch);
 
 	struct Vertex {
-		uint16_t x;
-		uint16_t y;
+		// 12.4 relative to the drawing offset, negative left of and above it
+		int32_t x;
+		int32_t y;
 		uint32_t z;
 		uint8_t fog;
 		uint8_t r;
 		uint8_t g;
 		uint8_t b;
 		uint8_t a;
+		// 12.4 texel coordinates with FST, otherwise s and t are divided by q
+		uint16_t u;
+		uint16_t v;
+		float s;
+		float t;
+		float q;
 	};
 
+	// a ring of the last vertices kicked, strips cycle through all three slots
+	// while fans keep their first vertex in slot 0 and alternate between the others
 	Vertex vertex_queue[3];
 	uint8_t vertex_count;
+	uint8_t vertex_next;
+
+	// adds a vertex to the queue, drawing the prim it completes unless it came from XYZ3/XYZF3
+	void kick_vertex(uint16_t x, uint16_t y, uint32_t z, uint8_t f, bool draw);
 	std::vector<uint8_t> vram;
 
-	void draw_pixel(uint16_t x, uint16_t y, uint32_t z, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
-	void draw_sprite();
-	void draw_triangle();
+	struct Rect {
+		uint16_t x0;
+		uint16_t y0;
+		uint16_t x1;
+		uint16_t y1;
+	};
+
+	// interpolated values of 8 horizontally adjacent pixels
+	struct alignas(32) Span8 {
+		uint32_t z[8];
+		uint32_t r[8];
+		uint32_t g[8];
+		uint32_t b[8];
+		uint32_t a[8];
+		uint32_t fog[8];
+		// texel coordinates before wrapping
+		int32_t u[8];
+		int32_t v[8];
+	};
+
+	// inputs and output of the color stage besides the span itself
+	struct alignas(32) ColorArgs {
+		uint32_t dest[8];
+		int32_t dither[8];
+		uint32_t out[8];
+		uint32_t fog_color;
+		uint32_t fix;
+		uint32_t key;
+	};
+
+	// computes the final packed colors of a span, either jitted or the generic path
+	using ColorKernel = void (*)(const Span8* span, ColorArgs* args);
+
+	// color stage state captured when a prim is queued
+	struct ColorState {
+		uint32_t key;
+		ColorKernel kernel;
+		uint32_t fog_color;
+		int8_t dimx[4][4];
+	};
+
+	struct Prim;
+	// writes the pixels of a span set in mask, specialized for one draw state
+	using PixelPipeline = void (*)(Gs& gs, const Prim& prim, uint16_t x, uint16_t y, uint8_t mask, const Span8& span);
+
+	// replaces the colors of a span with the texture function of its texels
+	using TextureStage = void (*)(const Prim& prim, Span8& span);
+
+	// texture state captured when a prim is queued, stage is null without TME
+	struct TextureState {
+		TextureStage stage;
+		const uint32_t* texels;
+	};
+
+	// a function linear in the pixel position
+	struct Gradient {
+		double origin;
+		double step_x;
+		double step_y;
+	};
+
+	struct Edge {
+		// change of the edge function per pixel
+		int64_t step_x;
+		int64_t step_y;
+		// biased by the fill rule so covered pixels are exactly the ones >= 0
+		int64_t origin;
+	};
+
+	// a triangle set up once when it is queued, for every tile it covers
+	// the origin of the edges and gradients is the first pixel of its bounding box
+	struct TriangleSetup {
+		int16_t x0;
+		int16_t y0;
+		int16_t x1;
+		int16_t y1;
+		Edge edges[3];
+		Gradient z;
+		Gradient fog;
+		Gradient colors[4];
+		// u, v with FST, otherwise s, t and q
+		Gradient tex[3];
+	};
+
+	// values a flat sprite fills its rect with when nothing it writes depends on the pixels under it
+	struct FillState {
+		bool enabled;
+		// frame pixel as stored, FBMSK packed the same way
+		uint32_t frame;
+		uint32_t frame_keep;
+		uint32_t z;
+	};
+
+	// a primitive waiting in the tile bins, with the context it was kicked with
+	struct Prim {
+		Context ctx;
+		Vertex vertices[3];
+		uint16_t prim;
+		uint8_t type;
+		PixelPipeline pipeline;
+		ColorState color;
+		TextureState texture;
+		FillState fill;
+		// index into triangle_setups for triangles
+		uint32_t setup;
+	};
+
+	// what queue_prim derives from the registers, reused by the prims kicked until one of them is written
+	struct DrawState {
+		bool valid;
+		PixelPipeline pipeline;
+		ColorState color;
+		TextureState texture;
+		// rebound once one of these is drawn to
+		GsPageSet texture_pages;
+	} draw_state {};
+
+	std::vector<Prim> prims;
+	std::vector<TriangleSetup> triangle_setups;
+	// prim indices per tile of the frame buffer the batch draws to
+	std::vector<std::vector<uint32_t>> tile_bins {GS_TILES_X * GS_TILES_Y};
+	std::vector<uint16_t> active_tiles;
+	ThreadPool pool {std::max(std::thread::hardware_concurrency(), 1U) - 1};
+	GsJit jit;
+	GsTextureCache textures;
+	GsClut clut;
+	// CBP0 and CBP1 of the clut load conditions
+	uint16_t clut_cbp[2];
+	// pages written since the texture cache last looked at them
+	GsPageSet vram_dirty;
+	GsHiZ hiz;
+	// frame and z pages the queued prims cover, hi-z is only used while the two don't overlap
+	GsPageSet batch_frame_pages;
+	GsPageSet batch_z_pages;
+	bool hiz_enabled;
+
+	// type is a point, line, triangle or sprite, strips and fans queue their prims one at a time
+	void queue_prim(uint8_t type, const Vertex* vertices);
+	// pages is set to the pages the texels are decoded from
+	TextureState bind_texture(const Context& ctx, GsPageSet& pages);
+	// draws the queued prims and drops whatever was decoded or loaded from pages written since
+	void invalidate_dirty_pages();
+	void update_clut(const Context& ctx);
+	void flush();
+	void draw_prim(const Prim& prim, const Rect& clip);
+	void shade_span8(const Prim& prim, uint16_t x, uint16_t y, uint8_t mask, const Span8& span);
+	// sets the pixel columns of each 8-row band of the tile holding [x0, x1] x [y0, y1] where z, a plane with its
+	// origin at (origin_x, origin_y), fails the depth test against every value of its hi-z block, true if all of it does
+	bool hiz_occluded(const Prim& prim, const Gradient& z, int origin_x, int origin_y, int x0, int y0, int x1, int y1,
+		uint32_t (&occluded)[GS_TILE_SIZE / 8]);
+	void draw_point(const Prim& prim, const Rect& clip);
+	void draw_line(const Prim& prim, const Rect& clip);
+	void draw_sprite(const Prim& prim, const Rect& clip);
+	void draw_triangle(const Prim& prim, const Rect& clip);
 };
 
 #define SCREEN_WIDTH 640
@@ -0,0 +1,158 @@
+#include "gs_format.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+namespace {
+	using ReadPixels8 = void (*)(const uint8_t* vram, const uint32_t* addr, uint32_t* out);
+	using WritePixels8 = void (*)(uint8_t* vram, const uint32_t* addr, uint8_t mask, const uint32_t* in);
+
+	struct SpanOps {
+		ReadPixels8 read;
+		WritePixels8 write;
+	};
+
+	template<uint8_t Psm>
+	constexpr SpanOps make_ops() {
+		return {gs_read_pixels8<Psm>, gs_write_pixels8<Psm>};
+	}
+
+	SpanOps get_ops(uint8_t psm) {
+		switch (psm) {
+			case GS_PSMCT32:
+				return make_ops<GS_PSMCT32>();
+			case GS_PSMCT24:
+				return make_ops<GS_PSMCT24>();
+			case GS_PSMCT16:
+				return make_ops<GS_PSMCT16>();
+			case GS_PSMCT16S:
+				return make_ops<GS_PSMCT16S>();
+			case GS_PSMT8:
+				return make_ops<GS_PSMT8>();
+			case GS_PSMT4:
+				return make_ops<GS_PSMT4>();
+			case GS_PSMT8H:
+				return make_ops<GS_PSMT8H>();
+			case GS_PSMT4HL:
+				return make_ops<GS_PSMT4HL>();
+			case GS_PSMT4HH:
+				return make_ops<GS_PSMT4HH>();
+			case GS_PSMZ32:
+				return make_ops<GS_PSMZ32>();
+			case GS_PSMZ24:
+				return make_ops<GS_PSMZ24>();
+			case GS_PSMZ16:
+				return make_ops<GS_PSMZ16>();
+			case GS_PSMZ16S:
+				return make_ops<GS_PSMZ16S>();
+			default:
+				UNREACHABLE("invalid gs pixel storage format");
+		}
+	}
+
+	// the 64 words of a block, value has no bits of keep set
+	void fill_block(uint32_t* words, uint32_t value, uint32_t keep) {
+#ifdef __AVX2__
+		auto v = _mm256_set1_epi32(static_cast<int>(value));
+		auto k = _mm256_set1_epi32(static_cast<int>(keep));
+		for (int i = 0; i < GS_BLOCK_SIZE / 4; i += 8) {
+			auto* p = reinterpret_cast<__m256i*>(words + i);
+			if (keep) {
+				_mm256_storeu_si256(p, _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(p), k), v));
+			}
+			else {
+				_mm256_storeu_si256(p, v);
+			}
+		}
+#else
+		for (int i = 0; i < GS_BLOCK_SIZE / 4; ++i) {
+			words[i] = (words[i] & keep) | value;
+		}
+#endif
+	}
+
+	void span_addresses(const GsSwizzle& swizzle, uint32_t bp, uint32_t bw, uint32_t x, uint32_t y, uint32_t count, uint32_t* addr) {
+		for (uint32_t i = 0; i < 8; ++i) {
+			// lanes past the end repeat the last pixel so reads stay in bounds
+			addr[i] = gs_pixel_address(swizzle, bp, bw, x + std::min(i, count - 1), y);
+		}
+	}
+}
+
+void gs_read_span(const uint8_t* vram, uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x, uint32_t y, uint32_t count, uint32_t* out) {
+	auto ops = get_ops(psm);
+	const auto& swizzle = gs_get_swizzle(psm);
+	uint32_t addr[8];
+	uint32_t values[8];
+	for (uint32_t i = 0; i < count; i += 8) {
+		uint32_t n = std::min(count - i, 8U);
+		span_addresses(swizzle, bp, bw, x + i, y, n, addr);
+		if (n == 8) {
+			ops.read(vram, addr, out + i);
+		}
+		else {
+			ops.read(vram, addr, values);
+			std::copy_n(values, n, out + i);
+		}
+	}
+}
+
+void gs_write_span(uint8_t* vram, uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x, uint32_t y, uint32_t count, const uint32_t* in) {
+	auto ops = get_ops(psm);
+	const auto& swizzle = gs_get_swizzle(psm);
+	uint32_t addr[8];
+	uint32_t values[8] {};
+	for (uint32_t i = 0; i < count; i += 8) {
+		uint32_t n = std::min(count - i, 8U);
+		span_addresses(swizzle, bp, bw, x + i, y, n, addr);
+		if (n == 8) {
+			ops.write(vram, addr, 0xFF, in + i);
+		}
+		else {
+			std::copy_n(in + i, n, values);
+			ops.write(vram, addr, (1U << n) - 1, values);
+		}
+	}
+}
+
+void gs_fill_rect(uint8_t* vram, uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t value, uint32_t keep) {
+	auto field = gs_psm_field(psm);
+	const auto& swizzle = gs_get_swizzle(psm);
+	if (swizzle.bits < 16) {
+		UNREACHABLE("gs fill of a format below 16 bits");
+	}
+
+	// bits of one pixel that are written, and the same for the whole words of a block
+	uint32_t write = field.mask & ~keep;
+	value &= write;
+	uint32_t word_value = field.unit_shift ? value | value << 16 : value;
+	uint32_t word_write = field.unit_shift ? write | write << 16 : write;
+	if (!word_write) {
+		return;
+	}
+
+	// blocks are 8 rows of 8 32-bit or 16 16-bit pixels
+	uint32_t block_width = 256 / swizzle.bits;
+	auto* words = reinterpret_cast<uint32_t*>(vram);
+	for (uint32_t by = y0 & ~7U; by < y1; by += 8) {
+		for (uint32_t bx = x0 & ~(block_width - 1); bx < x1; bx += block_width) {
+			uint32_t px0 = std::max(x0, bx);
+			uint32_t px1 = std::min(x1, bx + block_width);
+			uint32_t py0 = std::max(y0, by);
+			uint32_t py1 = std::min(y1, by + 8);
+			// a block's first pixel is at its lowest address
+			if (px1 - px0 == block_width && py1 - py0 == 8) {
+				uint32_t first = gs_pixel_address(swizzle, bp, bw, bx, by) >> field.unit_shift;
+				fill_block(words + first, word_value, ~word_write);
+				continue;
+			}
+			for (uint32_t y = py0; y < py1; ++y) {
+				for (uint32_t x = px0; x < px1; ++x) {
+					uint32_t addr = gs_pixel_address(swizzle, bp, bw, x, y);
+					uint32_t shift = field.unit_shift ? (addr & 1) * 16 : 0;
+					auto& word = words[addr >> field.unit_shift];
+					word = (word & ~(write << shift)) | value << shift;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstdint>
+#include <immintrin.h>
+#include "gs_swizzle.hpp"
+
+// where a format's pixel lives in the 32-bit word holding it
+struct GsPsmField {
+	// log2 of the pixels sharing one word
+	uint8_t unit_shift;
+	// bit position for formats that own part of every word
+	uint8_t shift;
+	uint32_t mask;
+	bool color16;
+};
+
+constexpr GsPsmField gs_psm_field(uint8_t psm) {
+	switch (psm) {
+		case GS_PSMCT24:
+		case GS_PSMZ24:
+			return {0, 0, 0xFFFFFF, false};
+		case GS_PSMCT16:
+		case GS_PSMCT16S:
+			return {1, 0, 0xFFFF, true};
+		case GS_PSMZ16:
+		case GS_PSMZ16S:
+			return {1, 0, 0xFFFF, false};
+		case GS_PSMT8:
+			return {2, 0, 0xFF, false};
+		case GS_PSMT4:
+			return {3, 0, 0xF, false};
+		case GS_PSMT8H:
+			return {0, 24, 0xFF, false};
+		case GS_PSMT4HL:
+			return {0, 24, 0xF, false};
+		case GS_PSMT4HH:
+			return {0, 28, 0xF, false};
+		default:
+			return {0, 0, 0xFFFFFFFF, false};
+	}
+}
+
+// 16-bit colors are 5 bits per channel and a 1-bit alpha that reads back as 0x80
+inline uint32_t gs_expand16(uint32_t c) {
+	return (c & 0x1F) << 3 | (c & 0x3E0) << 6 | (c & 0x7C00) << 9 | (c & 0x8000) << 16;
+}
+
+inline uint32_t gs_pack16(uint32_t c) {
+	return (c >> 3 & 0x1F) | (c >> 6 & 0x3E0) | (c >> 9 & 0x7C00) | (c >> 16 & 0x8000);
+}
+
+#ifdef __AVX2__
+inline __m256i gs_expand16x8(__m256i c) {
+	auto r = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x1F)), 3);
+	auto g = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x3E0)), 6);
+	auto b = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x7C00)), 9);
+	auto a = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x8000)), 16);
+	return _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, a));
+}
+
+inline __m256i gs_pack16x8(__m256i c) {
+	auto r = _mm256_and_si256(_mm256_srli_epi32(c, 3), _mm256_set1_epi32(0x1F));
+	auto g = _mm256_and_si256(_mm256_srli_epi32(c, 6), _mm256_set1_epi32(0x3E0));
+	auto b = _mm256_and_si256(_mm256_srli_epi32(c, 9), _mm256_set1_epi32(0x7C00));
+	auto a = _mm256_and_si256(_mm256_srli_epi32(c, 16), _mm256_set1_epi32(0x8000));
+	return _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, a));
+}
+#endif
+
+// reads 8 pixels at addresses from gs_pixel_address: colors come out as ABGR8888, indices and z as integers
+template<uint8_t Psm>
+inline void gs_read_pixels8(const uint8_t* vram, const uint32_t* addr, uint32_t* out) {
+	constexpr auto field = gs_psm_field(Psm);
+#ifdef __AVX2__
+	auto address = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(addr));
+	auto index = _mm256_srli_epi32(address, field.unit_shift);
+	auto words = _mm256_i32gather_epi32(reinterpret_cast<const int*>(vram), index, 4);
+	if constexpr (field.unit_shift) {
+		auto sub = _mm256_and_si256(address, _mm256_set1_epi32((1 << field.unit_shift) - 1));
+		words = _mm256_srlv_epi32(words, _mm256_slli_epi32(sub, 5 - field.unit_shift));
+	}
+	else if constexpr (field.shift) {
+		words = _mm256_srli_epi32(words, field.shift);
+	}
+	if constexpr (field.mask != 0xFFFFFFFF) {
+		words = _mm256_and_si256(words, _mm256_set1_epi32(static_cast<int>(field.mask)));
+	}
+	if constexpr (field.color16) {
+		words = gs_expand16x8(words);
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), words);
+#else
+	constexpr uint32_t bits = 32 >> field.unit_shift;
+	auto* words = reinterpret_cast<const uint32_t*>(vram);
+	for (int lane = 0; lane < 8; ++lane) {
+		uint32_t shift = field.unit_shift ? (addr[lane] & ((1U << field.unit_shift) - 1)) * bits : field.shift;
+		uint32_t value = words[addr[lane] >> field.unit_shift] >> shift & field.mask;
+		out[lane] = field.color16 ? gs_expand16(value) : value;
+	}
+#endif
+}
+
+// writes the lanes of mask, 16-bit colors are packed from ABGR8888
+template<uint8_t Psm>
+inline void gs_write_pixels8(uint8_t* vram, const uint32_t* addr, uint8_t mask, const uint32_t* in) {
+	constexpr auto field = gs_psm_field(Psm);
+	constexpr uint32_t bits = 32 >> field.unit_shift;
+	auto* words = reinterpret_cast<uint32_t*>(vram);
+
+	alignas(32) uint32_t values[8];
+	if constexpr (field.color16) {
+#ifdef __AVX2__
+		auto packed = gs_pack16x8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)));
+		_mm256_store_si256(reinterpret_cast<__m256i*>(values), packed);
+#else
+		for (int lane = 0; lane < 8; ++lane) {
+			values[lane] = gs_pack16(in[lane]);
+		}
+#endif
+		in = values;
+	}
+
+	// pixels sharing a word are merged one at a time
+	while (mask) {
+		int lane = __builtin_ctz(mask);
+		mask &= mask - 1;
+		if constexpr (field.mask == 0xFFFFFFFF) {
+			words[addr[lane]] = in[lane];
+		}
+		else {
+			uint32_t shift = field.unit_shift ? (addr[lane] & ((1U << field.unit_shift) - 1)) * bits : field.shift;
+			uint32_t keep = ~(field.mask << shift);
+			auto& word = words[addr[lane] >> field.unit_shift];
+			word = (word & keep) | (in[lane] & field.mask) << shift;
+		}
+	}
+}
+
+// a row of count pixels starting at (x, y) of the buffer at bp with width bw
+void gs_read_span(const uint8_t* vram, uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x, uint32_t y, uint32_t count, uint32_t* out);
+void gs_write_span(uint8_t* vram, uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x, uint32_t y, uint32_t count, const uint32_t* in);
+
+// sets the pixels of [x0, x1) x [y0, y1) to value, a pixel as stored (16-bit colors packed), keeping the bits set in keep
+// only the 32, 24 and 16-bit formats, whole blocks are filled with vector stores
+void gs_fill_rect(uint8_t* vram, uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t value, uint32_t keep);
@@ -0,0 +1,87 @@
+#include "gs_hiz.hpp"
+#include <algorithm>
+#include <immintrin.h>
+
+void GsHiZ::compute(const uint8_t* vram, uint32_t block, uint8_t psm) {
+	const uint8_t* data = vram + block * GS_BLOCK_SIZE;
+	uint32_t min;
+	uint32_t max;
+#ifdef __AVX2__
+	auto lo = _mm256_set1_epi32(-1);
+	auto hi = _mm256_setzero_si256();
+	if (psm & 0x2) {
+		auto lo16 = _mm256_set1_epi16(-1);
+		auto hi16 = _mm256_setzero_si256();
+		for (int i = 0; i < GS_BLOCK_SIZE; i += 32) {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			lo16 = _mm256_min_epu16(lo16, v);
+			hi16 = _mm256_max_epu16(hi16, v);
+		}
+		// widen the 16-bit lanes so one reduction below handles both sizes
+		auto mask = _mm256_set1_epi32(0xFFFF);
+		lo = _mm256_min_epu32(_mm256_and_si256(lo16, mask), _mm256_srli_epi32(lo16, 16));
+		hi = _mm256_max_epu32(_mm256_and_si256(hi16, mask), _mm256_srli_epi32(hi16, 16));
+	}
+	else {
+		auto mask = _mm256_set1_epi32(psm == GS_PSMZ24 ? 0xFFFFFF : -1);
+		for (int i = 0; i < GS_BLOCK_SIZE; i += 32) {
+			auto v = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), mask);
+			lo = _mm256_min_epu32(lo, v);
+			hi = _mm256_max_epu32(hi, v);
+		}
+	}
+	alignas(32) uint32_t los[8];
+	alignas(32) uint32_t his[8];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(los), lo);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(his), hi);
+	min = *std::min_element(los, los + 8);
+	max = *std::max_element(his, his + 8);
+#else
+	min = 0xFFFFFFFF;
+	max = 0;
+	if (psm & 0x2) {
+		auto* values = reinterpret_cast<const uint16_t*>(data);
+		for (int i = 0; i < GS_BLOCK_SIZE / 2; ++i) {
+			min = std::min<uint32_t>(min, values[i]);
+			max = std::max<uint32_t>(max, values[i]);
+		}
+	}
+	else {
+		auto* values = reinterpret_cast<const uint32_t*>(data);
+		uint32_t mask = psm == GS_PSMZ24 ? 0xFFFFFF : 0xFFFFFFFF;
+		for (int i = 0; i < GS_BLOCK_SIZE / 4; ++i) {
+			min = std::min(min, values[i] & mask);
+			max = std::max(max, values[i] & mask);
+		}
+	}
+#endif
+	blocks[block] = {min, max, psm, true, false, 0};
+}
+
+void GsHiZ::fill(uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t z) {
+	const auto& swizzle = gs_get_swizzle(psm);
+	uint32_t block_width = 256 / swizzle.bits;
+	for (uint32_t by = y0 & ~7U; by < y1; by += 8) {
+		for (uint32_t bx = x0 & ~(block_width - 1); bx < x1; bx += block_width) {
+			uint32_t block = gs_hiz_block(psm, gs_pixel_address(swizzle, bp, bw, bx, by));
+			bool whole = bx >= x0 && bx + block_width <= x1 && by >= y0 && by + 8 <= y1;
+			if (whole) {
+				blocks[block] = {z, z, psm, true, false, 0};
+			}
+			else {
+				widen(block, psm, z, z, UINT32_MAX);
+			}
+		}
+	}
+}
+
+void GsHiZ::invalidate(const GsPageSet& pages) {
+	constexpr uint32_t BLOCKS_PER_PAGE = GS_PAGE_SIZE / GS_BLOCK_SIZE;
+	for (size_t page = 0; page < pages.size(); ++page) {
+		if (pages[page]) {
+			for (uint32_t i = 0; i < BLOCKS_PER_PAGE; ++i) {
+				blocks[page * BLOCKS_PER_PAGE + i].valid = false;
+			}
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "gs_swizzle.hpp"
+#include "gs_texture.hpp"
+
+// the depth range of every vram block holding z, so spans behind all of it can be rejected without reading it
+// z writes widen a range instead of recomputing it, which leaves it loose until a later prim could use the exact one
+struct GsHiZ {
+	struct Block {
+		uint32_t min;
+		uint32_t max;
+		// the z format the range was computed for
+		uint8_t psm;
+		bool valid;
+		// written since it was computed, the values may have moved inside it
+		bool loose;
+		// index of the prim that last widened the range, a prim never occludes itself
+		uint32_t writer;
+	};
+
+	std::vector<Block> blocks = std::vector<Block>(GS_VRAM_SIZE / GS_BLOCK_SIZE);
+
+	// sets the range of a block from the values it holds
+	void compute(const uint8_t* vram, uint32_t block, uint8_t psm);
+	// values in [min, max] were written to a block
+	void widen(uint32_t block, uint8_t psm, uint32_t min, uint32_t max, uint32_t writer) {
+		auto& range = blocks[block];
+		if (range.psm != psm) {
+			range.valid = false;
+		}
+		range.min = std::min(range.min, min);
+		range.max = std::max(range.max, max);
+		range.loose = true;
+		range.writer = writer;
+	}
+	// the rect [x0, x1) x [y0, y1) of a z buffer was filled with z
+	void fill(uint8_t psm, uint32_t bp, uint32_t bw, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t z);
+	// the pages were written by something other than the z writes above
+	void invalidate(const GsPageSet& pages);
+};
+
+// the block holding a pixel at an address from gs_pixel_address
+constexpr uint32_t gs_hiz_block(uint8_t psm, uint32_t addr) {
+	return addr >> (psm & 0x2 ? 7 : 6);
+}
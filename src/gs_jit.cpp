@@ -0,0 +1,319 @@
+#include "gs_jit.hpp"
+#include "gs.hpp"
+#include "gs_pixel.hpp"
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#define GS_JIT_SUPPORTED 1
+#else
+#define GS_JIT_SUPPORTED 0
+#endif
+
+namespace {
+	constexpr int RSI = 6;
+	constexpr int RDI = 7;
+
+	// vex opcode maps and prefixes
+	constexpr uint8_t MAP_0F = 1;
+	constexpr uint8_t MAP_0F38 = 2;
+	constexpr uint8_t PP_66 = 1;
+	constexpr uint8_t PP_F3 = 2;
+
+	// encodes the few 256-bit avx2 instructions the color kernels are made of
+	class Emitter {
+	public:
+		std::vector<uint8_t> code;
+
+		void load(int ymm, int base, int32_t disp) {
+			vex_mem(MAP_0F, PP_F3, 0x6F, ymm, 0, base, disp);
+		}
+
+		void store(int ymm, int base, int32_t disp) {
+			vex_mem(MAP_0F, PP_F3, 0x7F, ymm, 0, base, disp);
+		}
+
+		void broadcast(int ymm, int base, int32_t disp) {
+			vex_mem(MAP_0F38, PP_66, 0x58, ymm, 0, base, disp);
+		}
+
+		void paddd(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0xFE, dst, a, b); }
+		void psubd(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0xFA, dst, a, b); }
+		void pand(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0xDB, dst, a, b); }
+		void pandn(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0xDF, dst, a, b); }
+		void por(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0xEB, dst, a, b); }
+		void pxor(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0xEF, dst, a, b); }
+		void pcmpeqd(int dst, int a, int b) { vex_reg(MAP_0F, PP_66, 0x76, dst, a, b); }
+		void pmulld(int dst, int a, int b) { vex_reg(MAP_0F38, PP_66, 0x40, dst, a, b); }
+		void pmaxsd(int dst, int a, int b) { vex_reg(MAP_0F38, PP_66, 0x3D, dst, a, b); }
+		void pminsd(int dst, int a, int b) { vex_reg(MAP_0F38, PP_66, 0x39, dst, a, b); }
+
+		void psrld(int dst, int src, uint8_t imm) { shift(2, dst, src, imm); }
+		void psrad(int dst, int src, uint8_t imm) { shift(4, dst, src, imm); }
+		void pslld(int dst, int src, uint8_t imm) { shift(6, dst, src, imm); }
+
+		void mov(int dst, int src) {
+			if (dst != src) {
+				por(dst, src, src);
+			}
+		}
+
+		void ret() {
+			// vzeroupper
+			code.insert(code.end(), {0xC5, 0xF8, 0x77, 0xC3});
+		}
+
+	private:
+		void vex(uint8_t map, uint8_t pp, int reg, int vvvv, int rm) {
+			code.push_back(0xC4);
+			code.push_back(static_cast<uint8_t>((~reg & 8) << 4 | 0x40 | (~rm & 8) << 2 | map));
+			code.push_back(static_cast<uint8_t>((~vvvv & 0xF) << 3 | 1 << 2 | pp));
+		}
+
+		void vex_reg(uint8_t map, uint8_t pp, uint8_t opcode, int reg, int vvvv, int rm) {
+			vex(map, pp, reg, vvvv, rm);
+			code.push_back(opcode);
+			code.push_back(static_cast<uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7)));
+		}
+
+		void vex_mem(uint8_t map, uint8_t pp, uint8_t opcode, int reg, int vvvv, int base, int32_t disp) {
+			vex(map, pp, reg, vvvv, base);
+			code.push_back(opcode);
+			code.push_back(static_cast<uint8_t>(0x80 | (reg & 7) << 3 | (base & 7)));
+			for (int i = 0; i < 4; ++i) {
+				code.push_back(static_cast<uint8_t>(disp >> (i * 8)));
+			}
+		}
+
+		void shift(int ext, int dst, int src, uint8_t imm) {
+			vex_reg(MAP_0F, PP_66, 0x72, ext, dst, src);
+			code.push_back(imm);
+		}
+	};
+
+	// register allocation, r g b a are also the color channels by index
+	enum Ymm {
+		R,
+		G,
+		B,
+		A,
+		FOG,
+		INV_FOG,
+		TMP,
+		DEST,
+		DIFF,
+		ALPHA,
+		FIX,
+		ZERO,
+		MASK_FF,
+		CD,
+		UNBLENDED,
+		PABE_MASK
+	};
+
+	// same arithmetic as color_generic in gs_pixel.cpp, one channel per 8-lane register
+	std::vector<uint8_t> compile(uint32_t key) {
+		Emitter e;
+		e.load(R, RDI, offsetof(Gs::Span8, r));
+		e.load(G, RDI, offsetof(Gs::Span8, g));
+		e.load(B, RDI, offsetof(Gs::Span8, b));
+		e.load(A, RDI, offsetof(Gs::Span8, a));
+		e.pxor(ZERO, ZERO, ZERO);
+		e.pcmpeqd(MASK_FF, MASK_FF, MASK_FF);
+		e.psrld(MASK_FF, MASK_FF, 24);
+
+		if (key & GS_COLOR_FGE) {
+			e.load(FOG, RDI, offsetof(Gs::Span8, fog));
+			e.psubd(INV_FOG, MASK_FF, FOG);
+			for (int ch = R; ch <= B; ++ch) {
+				e.broadcast(TMP, RSI, offsetof(Gs::ColorArgs, fog_color));
+				if (ch != R) {
+					e.psrld(TMP, TMP, ch * 8);
+				}
+				e.pand(TMP, TMP, MASK_FF);
+				e.pmulld(TMP, TMP, INV_FOG);
+				e.pmulld(ch, ch, FOG);
+				e.paddd(ch, ch, TMP);
+				e.psrld(ch, ch, 8);
+			}
+		}
+
+		if (key & GS_COLOR_ABE) {
+			uint8_t sel_a = GS_COLOR_BLEND_A(key);
+			uint8_t sel_b = GS_COLOR_BLEND_B(key);
+			uint8_t sel_c = GS_COLOR_BLEND_C(key);
+			uint8_t sel_d = GS_COLOR_BLEND_D(key);
+			bool needs_cd = sel_a == 1 || sel_b == 1 || sel_d == 1;
+
+			e.load(DEST, RSI, offsetof(Gs::ColorArgs, dest));
+			int alpha = A;
+			if (sel_c == 1) {
+				e.psrld(ALPHA, DEST, 24);
+				alpha = ALPHA;
+			}
+			else if (sel_c == 2) {
+				e.broadcast(FIX, RSI, offsetof(Gs::ColorArgs, fix));
+				alpha = FIX;
+			}
+
+			bool pabe = key & GS_COLOR_PABE;
+			if (pabe) {
+				// all ones in the lanes whose source alpha msb is set
+				e.pslld(PABE_MASK, A, 24);
+				e.psrad(PABE_MASK, PABE_MASK, 31);
+			}
+
+			for (int ch = R; ch <= B; ++ch) {
+				if (needs_cd) {
+					if (ch != R) {
+						e.psrld(CD, DEST, ch * 8);
+						e.pand(CD, CD, MASK_FF);
+					}
+					else {
+						e.pand(CD, DEST, MASK_FF);
+					}
+				}
+				int operands[3] {ch, CD, ZERO};
+				int a = operands[sel_a];
+				int b = operands[sel_b];
+				int d = operands[sel_d];
+				if (pabe) {
+					e.mov(UNBLENDED, ch);
+				}
+				if (sel_a == sel_b) {
+					e.mov(ch, d);
+				}
+				else {
+					e.psubd(DIFF, a, b);
+					e.pmulld(DIFF, DIFF, alpha);
+					e.psrad(DIFF, DIFF, 7);
+					e.paddd(ch, DIFF, d);
+				}
+				if (pabe) {
+					e.pand(ch, ch, PABE_MASK);
+					e.pandn(UNBLENDED, PABE_MASK, UNBLENDED);
+					e.por(ch, ch, UNBLENDED);
+				}
+			}
+		}
+
+		if (key & GS_COLOR_DTHE) {
+			e.load(TMP, RSI, offsetof(Gs::ColorArgs, dither));
+			for (int ch = R; ch <= B; ++ch) {
+				e.paddd(ch, ch, TMP);
+			}
+		}
+
+		for (int ch = R; ch <= B; ++ch) {
+			if (key & GS_COLOR_COLCLAMP) {
+				e.pmaxsd(ch, ch, ZERO);
+				e.pminsd(ch, ch, MASK_FF);
+			}
+			else {
+				e.pand(ch, ch, MASK_FF);
+			}
+		}
+
+		e.pslld(G, G, 8);
+		e.pslld(B, B, 16);
+		e.pslld(A, A, 24);
+		e.por(R, R, G);
+		e.por(R, R, B);
+		e.por(R, R, A);
+		if (key & GS_COLOR_FBA) {
+			e.pcmpeqd(TMP, TMP, TMP);
+			e.pslld(TMP, TMP, 31);
+			e.por(R, R, TMP);
+		}
+		e.store(R, RSI, offsetof(Gs::ColorArgs, out));
+		e.ret();
+		return e.code;
+	}
+}
+
+GsJit::GsJit() {
+#if GS_JIT_SUPPORTED
+	__builtin_cpu_init();
+	enabled = __builtin_cpu_supports("avx2");
+#endif
+	if (enabled) {
+		thread = std::thread {[this]() {
+			compiler_main();
+		}};
+	}
+}
+
+GsJit::~GsJit() {
+	if (thread.joinable()) {
+		{
+			std::lock_guard guard {mutex};
+			quit = true;
+		}
+		cv.notify_one();
+		thread.join();
+	}
+#if GS_JIT_SUPPORTED
+	for (auto [ptr, size] : pages) {
+		munmap(ptr, size);
+	}
+#endif
+}
+
+const void* GsJit::get(uint32_t key) {
+	if (!enabled) {
+		return nullptr;
+	}
+
+	auto [it, inserted] = kernels.try_emplace(key, nullptr);
+	if (inserted) {
+		{
+			std::lock_guard guard {mutex};
+			queue.emplace_back(key, &it->second);
+		}
+		cv.notify_one();
+		return nullptr;
+	}
+	return it->second.load(std::memory_order_acquire);
+}
+
+void GsJit::compiler_main() {
+	while (true) {
+		std::pair<uint32_t, std::atomic<const void*>*> job;
+		{
+			std::unique_lock lock {mutex};
+			cv.wait(lock, [&]() {
+				return quit || !queue.empty();
+			});
+			if (quit) {
+				return;
+			}
+			job = queue.back();
+			queue.pop_back();
+		}
+
+		job.second->store(install(compile(job.first)), std::memory_order_release);
+	}
+}
+
+const void* GsJit::install(const std::vector<uint8_t>& code) {
+#if GS_JIT_SUPPORTED
+	// every kernel gets its own pages so they are never writable once published
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t size = (code.size() + page_size - 1) / page_size * page_size;
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		return nullptr;
+	}
+	std::memcpy(ptr, code.data(), code.size());
+	if (mprotect(ptr, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(ptr, size);
+		return nullptr;
+	}
+	pages.emplace_back(ptr, size);
+	return ptr;
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// compiles gs color stage kernels for a color key on a background thread
+class GsJit {
+public:
+	GsJit();
+	~GsJit();
+
+	// code of the kernel for key, null until it has been compiled or if the host can't run it
+	const void* get(uint32_t key);
+	// false if the host can't run the kernels, get never returns any then
+	bool available() const {
+		return enabled;
+	}
+
+private:
+	void compiler_main();
+	const void* install(const std::vector<uint8_t>& code);
+
+	bool enabled {};
+	std::unordered_map<uint32_t, std::atomic<const void*>> kernels;
+	std::vector<std::pair<uint32_t, std::atomic<const void*>*>> queue;
+	std::vector<std::pair<void*, size_t>> pages;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool quit {};
+};
@@ -0,0 +1,165 @@
+#include "gs.hpp"
+#include "gs_format.hpp"
+#include <algorithm>
+#include <immintrin.h>
+
+namespace {
+	// a read circuit as its DISPFB and DISPLAY registers set it up
+	struct Circuit {
+		uint32_t bp;
+		uint32_t bw;
+		uint8_t psm;
+		uint32_t x;
+		uint32_t y;
+		// position of the picture on the output relative to the top left of every enabled circuit
+		int offset_x;
+		int offset_y;
+		int width;
+		int height;
+	};
+
+	// the pcrtc only reads color formats, a circuit set to anything else shows nothing
+	bool displayable(uint64_t dispfb) {
+		uint8_t psm = dispfb >> 15 & 0x1F;
+		return psm == GS_PSMCT32 || psm == GS_PSMCT24 || psm == GS_PSMCT16 || psm == GS_PSMCT16S;
+	}
+
+	Circuit decode_circuit(uint64_t dispfb, uint64_t display, uint32_t origin_x, uint32_t origin_y, bool frame_mode) {
+		uint8_t psm = dispfb >> 15 & 0x1F;
+		// the display rect is in video clocks and raster lines, MAGH and MAGV are how many of them one pixel takes
+		uint32_t magh = (display >> 23 & 0xF) + 1;
+		uint32_t magv = (display >> 27 & 0x3) + 1;
+		Circuit circuit {
+			.bp = static_cast<uint32_t>(dispfb & 0x1FF) * 32,
+			.bw = static_cast<uint32_t>(dispfb >> 9 & 0x3F),
+			.psm = psm,
+			.x = static_cast<uint32_t>(dispfb >> 32 & 0x7FF),
+			.y = static_cast<uint32_t>(dispfb >> 43 & 0x7FF),
+			.offset_x = static_cast<int>(((display & 0xFFF) - origin_x) / magh),
+			.offset_y = static_cast<int>(((display >> 12 & 0x7FF) - origin_y) / magv),
+			.width = static_cast<int>(((display >> 32 & 0xFFF) + 1) / magh),
+			.height = static_cast<int>(((display >> 44 & 0x7FF) + 1) / magv)
+		};
+		// a field shows every other line of a frame mode buffer
+		if (frame_mode) {
+			circuit.offset_y /= 2;
+			circuit.height /= 2;
+		}
+		return circuit;
+	}
+
+	// reads the part of output row y a circuit covers into row, returns false if it covers none of it
+	bool read_row(const uint8_t* vram, const Circuit& circuit, int y, uint32_t field, bool frame_mode, uint32_t* row) {
+		int line = y - circuit.offset_y;
+		if (line < 0 || line >= circuit.height) {
+			return false;
+		}
+		int x0 = std::max(circuit.offset_x, 0);
+		int x1 = std::min(circuit.offset_x + circuit.width, SCREEN_WIDTH);
+		if (x0 >= x1) {
+			return false;
+		}
+		uint32_t src_y = circuit.y + (frame_mode ? line * 2 + field : line);
+		gs_read_span(vram, circuit.psm, circuit.bp, circuit.bw, circuit.x + x0 - circuit.offset_x, src_y & 0x7FF,
+			x1 - x0, row + x0);
+		// 24-bit buffers have no alpha and merge as opaque
+		if (circuit.psm == GS_PSMCT24) {
+			for (int x = x0; x < x1; ++x) {
+				row[x] |= 0x80000000;
+			}
+		}
+		return true;
+	}
+
+	// dest = src * alpha + dest * (1 - alpha), alpha is 0x80 for 1.0 with MMOD clear and 0xFF with it set
+	void merge_row(const uint32_t* src, uint32_t* dest, bool fixed_alpha, uint8_t alp) {
+#ifdef __SSE2__
+		auto zero = _mm_setzero_si128();
+		auto fixed = _mm_set1_epi16(static_cast<int16_t>(alp + (alp >> 7)));
+		auto one = _mm_set1_epi16(256);
+		auto max = _mm_set1_epi16(255);
+		auto weight = [&](__m128i c) {
+			if (fixed_alpha) {
+				return fixed;
+			}
+			// spread each pixel's alpha to its 4 lanes and scale it so 0x80 is 256
+			auto a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xFF), 0xFF);
+			a = _mm_min_epi16(_mm_slli_epi16(a, 1), max);
+			return _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+		};
+		auto blend = [&](__m128i s, __m128i d) {
+			auto a = weight(s);
+			auto sum = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(one, a)));
+			return _mm_srli_epi16(sum, 8);
+		};
+		for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+			auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+			auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + x));
+			auto lo = blend(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+			auto hi = blend(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(lo, hi));
+		}
+#else
+		for (int x = 0; x < SCREEN_WIDTH; ++x) {
+			uint32_t a = fixed_alpha ? alp : std::min(src[x] >> 24 << 1, 255U);
+			a += a >> 7;
+			uint32_t out = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				uint32_t c = ((src[x] >> shift & 0xFF) * a + (dest[x] >> shift & 0xFF) * (256 - a)) >> 8;
+				out |= c << shift;
+			}
+			dest[x] = out;
+		}
+#endif
+	}
+}
+
+void Gs::read_output(uint32_t* out, int pitch) {
+	sync();
+	// games can leave DISPFB at a format the pcrtc can't read for a while, the circuit is off until they fix it
+	bool enabled1 = (pmode & 1 << 0) && displayable(dispfb1);
+	bool enabled2 = (pmode & 1 << 1) && displayable(dispfb2);
+	bool fixed_alpha = pmode & 1 << 5;
+	bool background_only = pmode & 1 << 7;
+	auto alp = static_cast<uint8_t>(pmode >> 8);
+	bool frame_mode = (smode2 & 0b11) == 0b11;
+	uint32_t field = csr >> 13 & 1;
+	// BGCOLOR is r, g, b from the low byte up like an ABGR8888 pixel
+	auto background = static_cast<uint32_t>(bgcolor & 0xFFFFFF);
+
+	// circuits are placed relative to the one starting first on the screen
+	uint32_t origin_x = 0xFFF;
+	uint32_t origin_y = 0x7FF;
+	for (auto [enabled, display] : {std::pair {enabled1, display1}, std::pair {enabled2, display2}}) {
+		if (enabled) {
+			origin_x = std::min<uint32_t>(origin_x, display & 0xFFF);
+			origin_y = std::min<uint32_t>(origin_y, display >> 12 & 0x7FF);
+		}
+	}
+	Circuit circuit1 {};
+	Circuit circuit2 {};
+	if (enabled1) {
+		circuit1 = decode_circuit(dispfb1, display1, origin_x, origin_y, frame_mode);
+	}
+	if (enabled2) {
+		circuit2 = decode_circuit(dispfb2, display2, origin_x, origin_y, frame_mode);
+	}
+
+	alignas(16) uint32_t row1[SCREEN_WIDTH];
+	alignas(16) uint32_t row2[SCREEN_WIDTH];
+	for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+		// circuit 1 merges over circuit 2 or over the background color where circuit 2 is off or SLBG picks it
+		std::fill_n(row2, SCREEN_WIDTH, background);
+		if (enabled2 && !background_only) {
+			read_row(vram.data(), circuit2, y, field, frame_mode, row2);
+		}
+		// pixels circuit 1 doesn't cover merge row 2 with itself which leaves it unchanged
+		std::copy_n(row2, SCREEN_WIDTH, row1);
+		if (enabled1 && read_row(vram.data(), circuit1, y, field, frame_mode, row1)) {
+			merge_row(row1, row2, fixed_alpha, alp);
+		}
+		// the merged row is already in the byte order of the output, it's stored as is
+		std::copy_n(row2, SCREEN_WIDTH, out);
+		out = reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(out) + pitch);
+	}
+}
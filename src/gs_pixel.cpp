@@ -0,0 +1,440 @@
+#include "gs_pixel.hpp"
+#include "gs_format.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <immintrin.h>
+#include <iterator>
+#include <utility>
+
+#define GS_PRIM_FGE (1U << 5)
+#define GS_PRIM_ABE (1U << 6)
+
+namespace {
+	enum class DepthTest {
+		Never,
+		Always,
+		GEqual,
+		Greater
+	};
+
+	// lane bits where a < b and a == b, as unsigned 32-bit values
+	struct Compare8 {
+		uint8_t less;
+		uint8_t equal;
+	};
+
+	inline Compare8 compare8(const uint32_t* a, const uint32_t* b) {
+#ifdef __AVX2__
+		auto bias = _mm256_set1_epi32(static_cast<int>(0x80000000));
+		auto va = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)), bias);
+		auto vb = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)), bias);
+		return {
+			.less = static_cast<uint8_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(vb, va)))),
+			.equal = static_cast<uint8_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb))))
+		};
+#else
+		Compare8 result {};
+		for (int lane = 0; lane < 8; ++lane) {
+			result.less |= (a[lane] < b[lane]) << lane;
+			result.equal |= (a[lane] == b[lane]) << lane;
+		}
+		return result;
+#endif
+	}
+
+	// lane bits of the msb of each value
+	inline uint8_t msb8(const uint32_t* values) {
+#ifdef __AVX2__
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+		return static_cast<uint8_t>(_mm256_movemask_ps(_mm256_castsi256_ps(v)));
+#else
+		uint8_t bits = 0;
+		for (int lane = 0; lane < 8; ++lane) {
+			bits |= (values[lane] >> 31) << lane;
+		}
+		return bits;
+#endif
+	}
+
+	// lanes of alpha passing ATST against ref
+	uint8_t alpha_test8(uint8_t method, uint32_t ref, const uint32_t* alpha) {
+		alignas(32) uint32_t refs[8];
+		std::fill_n(refs, 8, ref);
+		auto cmp = compare8(alpha, refs);
+		uint8_t greater = ~(cmp.less | cmp.equal);
+		constexpr uint8_t ALL = 0xFF;
+		switch (method) {
+			// NEVER, ALWAYS
+			case 0:
+				return 0;
+			case 1:
+				return ALL;
+			// LESS, LEQUAL, EQUAL
+			case 2:
+				return cmp.less;
+			case 3:
+				return cmp.less | cmp.equal;
+			case 4:
+				return cmp.equal;
+			// GEQUAL, GREATER, NOTEQUAL
+			case 5:
+				return ~cmp.less;
+			case 6:
+				return greater;
+			default:
+				return ~cmp.equal;
+		}
+	}
+
+	// frame and z formats the pipelines are compiled for, in table order
+	constexpr uint8_t FRAME_PSMS[] {GS_PSMCT32, GS_PSMCT24, GS_PSMCT16, GS_PSMCT16S};
+	constexpr uint8_t Z_PSMS[] {GS_PSMZ32, GS_PSMZ24, GS_PSMZ16, GS_PSMZ16S};
+
+	template<uint8_t FramePsm, uint8_t ZPsm, DepthTest Ztst, bool Zmsk, bool Fbmsk>
+	void pixel_pipeline(Gs& gs, const Gs::Prim& prim, uint16_t x, uint16_t y, uint8_t mask, const Gs::Span8& span) {
+		if constexpr (Ztst == DepthTest::Never) {
+			return;
+		}
+
+		const auto& ctx = prim.ctx;
+		uint8_t* vram = gs.vram.data();
+		// both buffers are laid out with the frame width, their base pointers are in pages
+		uint32_t frame_addr[8];
+		uint32_t z_addr[8];
+		for (int lane = 0; lane < 8; ++lane) {
+			frame_addr[lane] = gs_pixel_address(gs_get_swizzle(FramePsm), ctx.frame.base_ptr * 32, ctx.frame.buf_width, x + lane, y);
+			z_addr[lane] = gs_pixel_address(gs_get_swizzle(ZPsm), ctx.z_buf.base_ptr * 32, ctx.frame.buf_width, x + lane, y);
+		}
+
+		// z values past what the buffer holds saturate
+		constexpr uint32_t z_max = gs_psm_field(ZPsm).mask;
+		alignas(32) uint32_t z[8];
+		for (int lane = 0; lane < 8; ++lane) {
+			z[lane] = std::min(span.z[lane], z_max);
+		}
+
+		const auto& test = ctx.test;
+		// 24-bit frames have no alpha for DATE to test
+		bool date = test.dest_alpha_test_enabled && FramePsm != GS_PSMCT24;
+		bool alpha_test = test.alpha_test_enabled;
+		bool rgb_only_fail = alpha_test && test.alpha_test_fail_processing == 3;
+
+		Gs::ColorArgs args {};
+		bool reads_frame = Fbmsk || (prim.color.key & GS_COLOR_ABE) || date || rgb_only_fail;
+		if (reads_frame) {
+			gs_read_pixels8<FramePsm>(vram, frame_addr, args.dest);
+		}
+		if (date) {
+			// DATM is the destination alpha msb that passes
+			mask &= test.dest_alpha_test_method ? msb8(args.dest) : ~msb8(args.dest);
+		}
+		if constexpr (FramePsm == GS_PSMCT24) {
+			// 24-bit frames blend as if their alpha was 1.0
+			for (auto& dest : args.dest) {
+				dest |= 0x80U << 24;
+			}
+		}
+
+		// AFAIL decides which of the frame and z writes a pixel failing the alpha test keeps
+		uint8_t frame_mask = mask;
+		uint8_t z_mask = mask;
+		uint8_t rgb_only = 0;
+		if (alpha_test) {
+			uint8_t pass = alpha_test8(test.alpha_test_method, test.alpha_ref, span.a);
+			uint8_t afail = test.alpha_test_fail_processing;
+			// KEEP
+			if (afail == 0) {
+				frame_mask &= pass;
+				z_mask &= pass;
+			}
+			// FB_ONLY
+			else if (afail == 1) {
+				z_mask &= pass;
+			}
+			// ZB_ONLY
+			else if (afail == 2) {
+				frame_mask &= pass;
+			}
+			// RGB_ONLY
+			else {
+				z_mask &= pass;
+				rgb_only = mask & ~pass;
+			}
+		}
+
+		if constexpr (Ztst == DepthTest::GEqual || Ztst == DepthTest::Greater) {
+			alignas(32) uint32_t z_dest[8];
+			gs_read_pixels8<ZPsm>(vram, z_addr, z_dest);
+			auto cmp = compare8(z, z_dest);
+			uint8_t pass = Ztst == DepthTest::GEqual ? ~cmp.less : ~(cmp.less | cmp.equal);
+			frame_mask &= pass;
+			z_mask &= pass;
+		}
+
+		if constexpr (!Zmsk) {
+			if (z_mask) {
+				gs_write_pixels8<ZPsm>(vram, z_addr, z_mask, z);
+			}
+		}
+		if (!frame_mask) {
+			return;
+		}
+
+		if (prim.color.key & GS_COLOR_DTHE) {
+			for (int lane = 0; lane < 8; ++lane) {
+				args.dither[lane] = prim.color.dimx[y & 3][(x + lane) & 3];
+			}
+		}
+		args.fog_color = prim.color.fog_color;
+		args.fix = ctx.alpha.fix;
+		args.key = prim.color.key;
+		prim.color.kernel(&span, &args);
+
+		// RGB_ONLY keeps the destination alpha like an FBMSK covering it
+		if (Fbmsk || rgb_only) {
+			for (int lane = 0; lane < 8; ++lane) {
+				uint32_t keep = ctx.frame.fb_mask | (rgb_only >> lane & 1 ? 0xFF000000 : 0);
+				args.out[lane] = (args.out[lane] & ~keep) | (args.dest[lane] & keep);
+			}
+		}
+		gs_write_pixels8<FramePsm>(vram, frame_addr, frame_mask, args.out);
+	}
+
+	void pipeline_unsupported(Gs&, const Gs::Prim&, uint16_t, uint16_t, uint8_t, const Gs::Span8&) {
+		UNREACHABLE("unsupported gs draw state");
+	}
+
+	// table index: frame psm, z psm, ztst, zmsk, fbmsk
+	constexpr size_t PIPELINE_COUNT = std::size(FRAME_PSMS) * std::size(Z_PSMS) * 4 * 2 * 2;
+
+	template<size_t Index>
+	constexpr Gs::PixelPipeline make_pipeline() {
+		constexpr bool fbmsk = Index % 2;
+		constexpr bool zmsk = Index / 2 % 2;
+		constexpr auto ztst = static_cast<DepthTest>(Index / 4 % 4);
+		constexpr uint8_t z_psm = Z_PSMS[Index / 16 % std::size(Z_PSMS)];
+		constexpr uint8_t frame_psm = FRAME_PSMS[Index / 16 / std::size(Z_PSMS)];
+		return pixel_pipeline<frame_psm, z_psm, ztst, zmsk, fbmsk>;
+	}
+
+	template<size_t... I>
+	constexpr std::array<Gs::PixelPipeline, PIPELINE_COUNT> make_pipeline_table(std::index_sequence<I...>) {
+		return {make_pipeline<I>()...};
+	}
+
+	constexpr auto PIPELINES = make_pipeline_table(std::make_index_sequence<PIPELINE_COUNT> {});
+
+	template<size_t N>
+	int psm_index(const uint8_t (&psms)[N], uint8_t psm) {
+		auto it = std::find(psms, psms + N, psm);
+		return it == psms + N ? -1 : static_cast<int>(it - psms);
+	}
+}
+
+Gs::PixelPipeline get_gs_pixel_pipeline(const Gs::Context& ctx) {
+	int frame_index = psm_index(FRAME_PSMS, ctx.frame.fmt);
+	int z_index = psm_index(Z_PSMS, GS_ZBUF_PSM(ctx.z_buf.fmt));
+	if (frame_index < 0 || z_index < 0) {
+		return pipeline_unsupported;
+	}
+
+	// with the depth test disabled every pixel passes
+	uint8_t ztst = ctx.test.depth_test_enabled ? ctx.test.depth_test_method : 1;
+	size_t index = frame_index;
+	index = index * std::size(Z_PSMS) + z_index;
+	index = index * 4 + ztst;
+	index = index * 2 + ctx.z_buf.buf_mask;
+	index = index * 2 + (ctx.frame.fb_mask != 0);
+	return PIPELINES[index];
+}
+
+Gs::ColorState get_gs_color_state(Gs& gs, const Gs::Context& ctx) {
+	uint32_t key = 0;
+	if (gs.prim & GS_PRIM_FGE) {
+		key |= GS_COLOR_FGE;
+	}
+	if (gs.prim & GS_PRIM_ABE) {
+		// the reserved selectors behave like 0 and FIX
+		key |= GS_COLOR_ABE;
+		key |= std::min<uint32_t>(ctx.alpha.a, 2) << 2;
+		key |= std::min<uint32_t>(ctx.alpha.b, 2) << 4;
+		key |= std::min<uint32_t>(ctx.alpha.c, 2) << 6;
+		key |= std::min<uint32_t>(ctx.alpha.d, 2) << 8;
+		if (gs.pabe) {
+			key |= GS_COLOR_PABE;
+		}
+	}
+	// dithering only applies when writing 16-bit color
+	if (gs.dither && (ctx.frame.fmt & 0x2)) {
+		key |= GS_COLOR_DTHE;
+	}
+	if (gs.signed_clamp) {
+		key |= GS_COLOR_COLCLAMP;
+	}
+	if (ctx.fba) {
+		key |= GS_COLOR_FBA;
+	}
+
+	Gs::ColorState state {
+		.key = key,
+		.kernel = reinterpret_cast<Gs::ColorKernel>(gs.jit.get(key)),
+		.fog_color = gs.fog_color
+	};
+	if (!state.kernel) {
+		state.kernel = gs_color_generic;
+	}
+	std::copy_n(&gs.dimx[0][0], 16, &state.dimx[0][0]);
+	return state;
+}
+
+Gs::FillState get_gs_sprite_fill(const Gs::Prim& prim) {
+	const auto& ctx = prim.ctx;
+	const auto& test = ctx.test;
+	const auto& vertex = prim.vertices[1];
+	bool ztst_always = !test.depth_test_enabled || test.depth_test_method == 1;
+	bool date = test.dest_alpha_test_enabled && ctx.frame.fmt != GS_PSMCT24;
+	if (prim.texture.stage || (prim.color.key & (GS_COLOR_ABE | GS_COLOR_DTHE)) || !ztst_always || date ||
+		prim.pipeline == pipeline_unsupported) {
+		return {};
+	}
+
+	// every pixel of a sprite has the color of its second vertex, so one span gives the color of all of them
+	Gs::Span8 span {};
+	std::fill_n(span.r, 8, vertex.r);
+	std::fill_n(span.g, 8, vertex.g);
+	std::fill_n(span.b, 8, vertex.b);
+	std::fill_n(span.a, 8, vertex.a);
+	std::fill_n(span.fog, 8, vertex.fog);
+	if (test.alpha_test_enabled && !(alpha_test8(test.alpha_test_method, test.alpha_ref, span.a) & 1)) {
+		return {};
+	}
+
+	Gs::ColorArgs args {};
+	args.fog_color = prim.color.fog_color;
+	args.fix = ctx.alpha.fix;
+	args.key = prim.color.key;
+	prim.color.kernel(&span, &args);
+
+	auto frame = gs_psm_field(ctx.frame.fmt);
+	auto z = gs_psm_field(GS_ZBUF_PSM(ctx.z_buf.fmt));
+	return {
+		.enabled = true,
+		.frame = frame.color16 ? gs_pack16(args.out[0]) : args.out[0] & frame.mask,
+		.frame_keep = frame.color16 ? gs_pack16(ctx.frame.fb_mask) : ctx.frame.fb_mask & frame.mask,
+		.z = std::min(vertex.z, z.mask)
+	};
+}
+
+#ifdef __AVX2__
+void gs_color_generic(const Gs::Span8* span, Gs::ColorArgs* args) {
+	uint32_t key = args->key;
+	auto load = [](const auto* values) {
+		return _mm256_load_si256(reinterpret_cast<const __m256i*>(values));
+	};
+	auto mask_ff = _mm256_set1_epi32(0xFF);
+	__m256i color[3] {load(span->r), load(span->g), load(span->b)};
+	auto alpha = load(span->a);
+
+	if (key & GS_COLOR_FGE) {
+		auto fog = load(span->fog);
+		auto inv_fog = _mm256_sub_epi32(mask_ff, fog);
+		for (int ch = 0; ch < 3; ++ch) {
+			auto fog_color = _mm256_set1_epi32(args->fog_color >> (ch * 8) & 0xFF);
+			auto sum = _mm256_add_epi32(_mm256_mullo_epi32(fog, color[ch]), _mm256_mullo_epi32(inv_fog, fog_color));
+			color[ch] = _mm256_srli_epi32(sum, 8);
+		}
+	}
+
+	if (key & GS_COLOR_ABE) {
+		auto dest = load(args->dest);
+		__m256i dest_color[3] {
+			_mm256_and_si256(dest, mask_ff),
+			_mm256_and_si256(_mm256_srli_epi32(dest, 8), mask_ff),
+			_mm256_and_si256(_mm256_srli_epi32(dest, 16), mask_ff)
+		};
+		__m256i factors[3] {alpha, _mm256_srli_epi32(dest, 24), _mm256_set1_epi32(args->fix)};
+		auto factor = factors[GS_COLOR_BLEND_C(key)];
+		auto blended = _mm256_set1_epi32(-1);
+		if (key & GS_COLOR_PABE) {
+			blended = _mm256_cmpgt_epi32(alpha, _mm256_set1_epi32(0x7F));
+		}
+		for (int ch = 0; ch < 3; ++ch) {
+			__m256i operands[3] {color[ch], dest_color[ch], _mm256_setzero_si256()};
+			auto a = operands[GS_COLOR_BLEND_A(key)];
+			auto b = operands[GS_COLOR_BLEND_B(key)];
+			auto d = operands[GS_COLOR_BLEND_D(key)];
+			auto result = _mm256_add_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(a, b), factor), 7), d);
+			color[ch] = _mm256_blendv_epi8(color[ch], result, blended);
+		}
+	}
+
+	for (int ch = 0; ch < 3; ++ch) {
+		if (key & GS_COLOR_DTHE) {
+			color[ch] = _mm256_add_epi32(color[ch], load(args->dither));
+		}
+		if (key & GS_COLOR_COLCLAMP) {
+			color[ch] = _mm256_min_epi32(_mm256_max_epi32(color[ch], _mm256_setzero_si256()), mask_ff);
+		}
+		else {
+			color[ch] = _mm256_and_si256(color[ch], mask_ff);
+		}
+	}
+
+	auto out = _mm256_or_si256(
+		_mm256_or_si256(color[0], _mm256_slli_epi32(color[1], 8)),
+		_mm256_or_si256(_mm256_slli_epi32(color[2], 16), _mm256_slli_epi32(alpha, 24)));
+	if (key & GS_COLOR_FBA) {
+		out = _mm256_or_si256(out, _mm256_set1_epi32(static_cast<int>(0x80000000)));
+	}
+	_mm256_store_si256(reinterpret_cast<__m256i*>(args->out), out);
+}
+#else
+void gs_color_generic(const Gs::Span8* span, Gs::ColorArgs* args) {
+	uint32_t key = args->key;
+	for (int lane = 0; lane < 8; ++lane) {
+		int32_t color[3] {
+			static_cast<int32_t>(span->r[lane]),
+			static_cast<int32_t>(span->g[lane]),
+			static_cast<int32_t>(span->b[lane])
+		};
+		auto alpha = static_cast<int32_t>(span->a[lane]);
+
+		if (key & GS_COLOR_FGE) {
+			auto fog = static_cast<int32_t>(span->fog[lane]);
+			for (int ch = 0; ch < 3; ++ch) {
+				int32_t fog_color = args->fog_color >> (ch * 8) & 0xFF;
+				color[ch] = (fog * color[ch] + (255 - fog) * fog_color) >> 8;
+			}
+		}
+
+		if ((key & GS_COLOR_ABE) && (!(key & GS_COLOR_PABE) || alpha >= 0x80)) {
+			uint32_t dest = args->dest[lane];
+			int32_t factors[3] {alpha, static_cast<int32_t>(dest >> 24), static_cast<int32_t>(args->fix)};
+			int32_t factor = factors[GS_COLOR_BLEND_C(key)];
+			for (int ch = 0; ch < 3; ++ch) {
+				int32_t operands[3] {color[ch], static_cast<int32_t>(dest >> (ch * 8) & 0xFF), 0};
+				int32_t a = operands[GS_COLOR_BLEND_A(key)];
+				int32_t b = operands[GS_COLOR_BLEND_B(key)];
+				int32_t d = operands[GS_COLOR_BLEND_D(key)];
+				color[ch] = ((a - b) * factor >> 7) + d;
+			}
+		}
+
+		for (int ch = 0; ch < 3; ++ch) {
+			if (key & GS_COLOR_DTHE) {
+				color[ch] += args->dither[lane];
+			}
+			if (key & GS_COLOR_COLCLAMP) {
+				color[ch] = std::clamp(color[ch], 0, 255);
+			}
+			else {
+				color[ch] &= 0xFF;
+			}
+		}
+
+		uint32_t fba = key & GS_COLOR_FBA ? 0x80000000 : 0;
+		args->out[lane] = static_cast<uint32_t>(alpha << 24 | color[2] << 16 | color[1] << 8 | color[0]) | fba;
+	}
+}
+#endif
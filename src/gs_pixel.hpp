@@ -0,0 +1,34 @@
+#pragma once
+#include "gs.hpp"
+
+// ZBUF.PSM is stored without the 0x30 every z format has set
+#define GS_ZBUF_PSM(fmt) (0x30 | (fmt))
+
+// color key bits, the blend selectors only matter with ABE
+#define GS_COLOR_FGE (1U << 0)
+#define GS_COLOR_ABE (1U << 1)
+#define GS_COLOR_BLEND_A(key) ((key) >> 2 & 0b11)
+#define GS_COLOR_BLEND_B(key) ((key) >> 4 & 0b11)
+#define GS_COLOR_BLEND_C(key) ((key) >> 6 & 0b11)
+#define GS_COLOR_BLEND_D(key) ((key) >> 8 & 0b11)
+#define GS_COLOR_DTHE (1U << 10)
+#define GS_COLOR_COLCLAMP (1U << 11)
+// PABE, only blend pixels whose source alpha has its msb set
+#define GS_COLOR_PABE (1U << 12)
+// FBA, set the msb of the written alpha
+#define GS_COLOR_FBA (1U << 13)
+
+// picks the pixel pipeline compiled for the draw state of ctx
+Gs::PixelPipeline get_gs_pixel_pipeline(const Gs::Context& ctx);
+
+// snapshots the color stage state of a prim about to be queued
+Gs::ColorState get_gs_color_state(Gs& gs, const Gs::Context& ctx);
+
+// the fill of a sprite without texture, blending, dithering, depth test or DATE whose alpha test passes,
+// disabled for anything else
+Gs::FillState get_gs_sprite_fill(const Gs::Prim& prim);
+
+void gs_color_generic(const Gs::Span8* span, Gs::ColorArgs* args);
+
+// picks the texture stage compiled for the texture function and wrap modes of ctx
+Gs::TextureStage get_gs_texture_stage(const Gs::Context& ctx);
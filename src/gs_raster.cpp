@@ -0,0 +1,822 @@
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <immintrin.h>
+#include "gs.hpp"
+#include "gs_pixel.hpp"
+#include "gs_format.hpp"
+
+#define GS_PRIM_IIP (1U << 3)
+#define GS_PRIM_TME (1U << 4)
+#define GS_PRIM_FGE (1U << 5)
+#define GS_PRIM_FST (1U << 8)
+
+namespace {
+	// false for triangles without area, which draw nothing
+	bool setup_triangle(const Gs::Prim& prim, Gs::TriangleSetup& setup);
+}
+
+void Gs::queue_prim(uint8_t type, const Vertex* vertices) {
+	const auto& ctx = contexts[(prim & 1 << 9) ? 1 : 0];
+
+	// the bins are laid out over one frame and z buffer, start a new batch when they change
+	if (!prims.empty()) {
+		const auto& batch = prims.front().ctx;
+		if (batch.frame.base_ptr != ctx.frame.base_ptr ||
+			batch.frame.buf_width != ctx.frame.buf_width ||
+			batch.frame.fmt != ctx.frame.fmt ||
+			batch.z_buf.base_ptr != ctx.z_buf.base_ptr ||
+			batch.z_buf.fmt != ctx.z_buf.fmt) {
+			flush();
+		}
+	}
+
+	uint8_t count = type == 0 ? 1 : type == 3 ? 3 : 2;
+	// points and lines round to the nearest pixel, which can be past the last whole one
+	int x0 = std::numeric_limits<int>::max();
+	int y0 = std::numeric_limits<int>::max();
+	int x1 = std::numeric_limits<int>::min();
+	int y1 = std::numeric_limits<int>::min();
+	for (uint8_t i = 0; i < count; ++i) {
+		x0 = std::min(x0, vertices[i].x >> 4);
+		y0 = std::min(y0, vertices[i].y >> 4);
+		x1 = std::max(x1, (vertices[i].x + 15) >> 4);
+		y1 = std::max(y1, (vertices[i].y + 15) >> 4);
+	}
+	x0 = std::max<int>(x0, ctx.scissor.x0);
+	y0 = std::max<int>(y0, ctx.scissor.y0);
+	x1 = std::min<int>(x1, ctx.scissor.x1);
+	y1 = std::min<int>(y1, ctx.scissor.y1);
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	// the texture is looked up again before this prim's own writes are marked if a previous one drew to it
+	bool texture_written = draw_state.texture.stage && (vram_dirty & draw_state.texture_pages).any();
+	if (!draw_state.valid || texture_written) {
+		TextureState texture {};
+		GsPageSet texture_pages;
+		// binding can flush, which drops the draw state
+		if (prim & GS_PRIM_TME) {
+			texture = bind_texture(ctx, texture_pages);
+		}
+		draw_state = {
+			.valid = true,
+			.pipeline = get_gs_pixel_pipeline(ctx),
+			.color = get_gs_color_state(*this, ctx),
+			.texture = texture,
+			.texture_pages = texture_pages
+		};
+	}
+
+	Prim new_prim {
+		.ctx = ctx,
+		.prim = prim,
+		.type = type,
+		.pipeline = draw_state.pipeline,
+		.color = draw_state.color,
+		.texture = draw_state.texture
+	};
+	std::copy_n(vertices, count, new_prim.vertices);
+	if (type == 6) {
+		new_prim.fill = get_gs_sprite_fill(new_prim);
+	}
+	else if (type == 3) {
+		TriangleSetup setup;
+		if (!setup_triangle(new_prim, setup)) {
+			return;
+		}
+		new_prim.setup = static_cast<uint32_t>(triangle_setups.size());
+		triangle_setups.push_back(setup);
+	}
+	GsPageSet frame_pages;
+	GsPageSet z_pages;
+	gs_mark_pages(frame_pages, ctx.frame.fmt, ctx.frame.base_ptr * 32, ctx.frame.buf_width, x0, y0, x1, y1);
+	gs_mark_pages(z_pages, GS_ZBUF_PSM(ctx.z_buf.fmt), ctx.z_buf.base_ptr * 32, ctx.frame.buf_width, x0, y0, x1, y1);
+	vram_dirty |= frame_pages;
+	if (!ctx.z_buf.buf_mask) {
+		vram_dirty |= z_pages;
+	}
+	batch_frame_pages |= frame_pages;
+	batch_z_pages |= z_pages;
+
+	auto index = static_cast<uint32_t>(prims.size());
+	prims.push_back(new_prim);
+	for (int ty = y0 / GS_TILE_SIZE; ty <= y1 / GS_TILE_SIZE; ++ty) {
+		for (int tx = x0 / GS_TILE_SIZE; tx <= x1 / GS_TILE_SIZE; ++tx) {
+			auto tile = static_cast<uint16_t>(ty * GS_TILES_X + tx);
+			auto& bin = tile_bins[tile];
+			if (bin.empty()) {
+				active_tiles.push_back(tile);
+			}
+			bin.push_back(index);
+		}
+	}
+
+	if (prims.size() >= GS_MAX_BATCH_PRIMS) {
+		flush();
+	}
+}
+
+void Gs::flush() {
+	if (prims.empty()) {
+		return;
+	}
+
+	// the frame and z buffers sharing pages swizzle differently, so the z of a pixel in one tile can share vram
+	// with the frame of a pixel in another
+	bool aliased = (batch_frame_pages & batch_z_pages).any();
+	// frame writes landing in the z buffer would go unseen by hi-z
+	hiz_enabled = !aliased;
+
+	// each tile draws its prims in submission order
+	auto draw_tile = [&](size_t i) {
+		auto tile = active_tiles[i];
+		uint16_t tile_x = tile % GS_TILES_X * GS_TILE_SIZE;
+		uint16_t tile_y = tile / GS_TILES_X * GS_TILE_SIZE;
+		Rect clip {
+			.x0 = tile_x,
+			.y0 = tile_y,
+			.x1 = static_cast<uint16_t>(tile_x + GS_TILE_SIZE - 1),
+			.y1 = static_cast<uint16_t>(tile_y + GS_TILE_SIZE - 1)
+		};
+		for (auto index : tile_bins[tile]) {
+			draw_prim(prims[index], clip);
+		}
+	};
+	// tiles touch disjoint pixels and vram unless the buffers alias, then they are drawn one after another
+	if (aliased) {
+		for (size_t i = 0; i < active_tiles.size(); ++i) {
+			draw_tile(i);
+		}
+	}
+	else {
+		pool.run(active_tiles.size(), draw_tile);
+	}
+
+	for (auto tile : active_tiles) {
+		tile_bins[tile].clear();
+	}
+	active_tiles.clear();
+	prims.clear();
+	triangle_setups.clear();
+	// the z ranges of blocks the frame was drawn to are stale once they are used as z again
+	hiz.invalidate(batch_frame_pages);
+	// z writes only keep the ranges up to date while hi-z is on
+	if (!hiz_enabled) {
+		hiz.invalidate(batch_z_pages);
+	}
+	batch_frame_pages.reset();
+	batch_z_pages.reset();
+	// trimming can evict the bound texture
+	textures.trim();
+	draw_state.valid = false;
+}
+
+void Gs::draw_prim(const Prim& prim, const Rect& clip) {
+	if (prim.type == 0) {
+		draw_point(prim, clip);
+	}
+	else if (prim.type == 1) {
+		draw_line(prim, clip);
+	}
+	else if (prim.type == 3) {
+		draw_triangle(prim, clip);
+	}
+	else if (prim.type == 6) {
+		draw_sprite(prim, clip);
+	}
+}
+
+// the caller has already clipped the span to the scissor
+void Gs::shade_span8(const Prim& prim, uint16_t x, uint16_t y, uint8_t mask, const Span8& span) {
+	if (prim.texture.stage) {
+		// the rasterizer keeps its span for the next pixels, texture a copy
+		Span8 textured = span;
+		prim.texture.stage(prim, textured);
+		prim.pipeline(*this, prim, x, y, mask, textured);
+		return;
+	}
+	prim.pipeline(*this, prim, x, y, mask, span);
+}
+
+static Gs::Rect clip_to_scissor(const Gs::Context& ctx, const Gs::Rect& clip) {
+	return {
+		.x0 = std::max(clip.x0, ctx.scissor.x0),
+		.y0 = std::max(clip.y0, ctx.scissor.y0),
+		.x1 = std::min(clip.x1, ctx.scissor.x1),
+		.y1 = std::min(clip.y1, ctx.scissor.y1)
+	};
+}
+
+namespace {
+	using Edge = Gs::Edge;
+	using Gradient = Gs::Gradient;
+
+	inline int64_t orient_2d(const Gs::Vertex& a, const Gs::Vertex& b, int64_t px, int64_t py) {
+		return static_cast<int64_t>(b.x - a.x) * (py - a.y) - static_cast<int64_t>(b.y - a.y) * (px - a.x);
+	}
+
+	Edge setup_edge(const Gs::Vertex& a, const Gs::Vertex& b, int x0, int y0) {
+		int dx = b.x - a.x;
+		int dy = b.y - a.y;
+		// top-left fill rule: pixels exactly on other edges belong to the neighbour
+		bool top_left = dy < 0 || (dy == 0 && dx > 0);
+		return {
+			.step_x = -16LL * dy,
+			.step_y = 16LL * dx,
+			.origin = orient_2d(a, b, x0 * 16, y0 * 16) - (top_left ? 0 : 1)
+		};
+	}
+
+	Gradient setup_gradient(const Edge (&edges)[3], double area, double a0, double a1, double a2) {
+		// the weight of a vertex is the edge function of the opposite edge
+		return {
+			.origin = (a0 * edges[0].origin + a1 * edges[1].origin + a2 * edges[2].origin) / area,
+			.step_x = (a0 * edges[0].step_x + a1 * edges[1].step_x + a2 * edges[2].step_x) / area,
+			.step_y = (a0 * edges[0].step_y + a1 * edges[1].step_y + a2 * edges[2].step_y) / area
+		};
+	}
+
+	// sprites map the coordinates of their corners linearly along one axis, p0 and p1 are 12.4
+	Gradient sprite_gradient(int p0, int p1, double a0, double a1, int origin, bool vertical) {
+		double step = p1 == p0 ? 0 : (a1 - a0) * 16 / (p1 - p0);
+		return {
+			.origin = a0 + (origin * 16 - p0) * step / 16,
+			.step_x = vertical ? 0 : step,
+			.step_y = vertical ? step : 0
+		};
+	}
+
+	inline double value_at(const Gradient& gradient, int dx, int dy) {
+		return gradient.origin + gradient.step_x * dx + gradient.step_y * dy;
+	}
+
+	inline int32_t to_texel(double coord) {
+		// coordinates far outside the texture, a q of 0 included, only need to stay outside it
+		if (!(coord > -32768.0)) {
+			return -32768;
+		}
+		if (coord > 32767.0) {
+			return 32767;
+		}
+		return static_cast<int32_t>(std::floor(coord));
+	}
+
+	// the u, v gradients with FST, otherwise s, t and q
+	struct TexGradients {
+		Gradient coords[3];
+		bool fst;
+		double width;
+		double height;
+	};
+
+	void texcoords8(const TexGradients& tex, int dx, int dy, Gs::Span8& span) {
+		for (int lane = 0; lane < 8; ++lane) {
+			double a = value_at(tex.coords[0], dx + lane, dy);
+			double b = value_at(tex.coords[1], dx + lane, dy);
+			if (tex.fst) {
+				span.u[lane] = to_texel(a / 16);
+				span.v[lane] = to_texel(b / 16);
+			}
+			else {
+				double q = value_at(tex.coords[2], dx + lane, dy);
+				span.u[lane] = to_texel(a / q * tex.width);
+				span.v[lane] = to_texel(b / q * tex.height);
+			}
+		}
+	}
+
+	TexGradients tex_setup(const Gs::Prim& prim) {
+		return {
+			.fst = static_cast<bool>(prim.prim & GS_PRIM_FST),
+			.width = static_cast<double>(1 << std::min<uint8_t>(prim.ctx.tex.width, 10)),
+			.height = static_cast<double>(1 << std::min<uint8_t>(prim.ctx.tex.height, 10))
+		};
+	}
+
+#ifdef __AVX2__
+	inline uint8_t coverage8(const int32_t (&e)[3], const __m256i (&lane_steps)[3]) {
+		auto e0 = _mm256_add_epi32(_mm256_set1_epi32(e[0]), lane_steps[0]);
+		auto e1 = _mm256_add_epi32(_mm256_set1_epi32(e[1]), lane_steps[1]);
+		auto e2 = _mm256_add_epi32(_mm256_set1_epi32(e[2]), lane_steps[2]);
+		auto outside = _mm256_or_si256(_mm256_or_si256(e0, e1), e2);
+		return ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xFF;
+	}
+
+	inline void interpolate8(double base, double step, uint32_t* out) {
+		auto lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+		auto v = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(base)),
+			_mm256_mul_ps(lanes, _mm256_set1_ps(static_cast<float>(step))));
+		v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+		_mm256_store_si256(reinterpret_cast<__m256i*>(out), _mm256_cvttps_epi32(v));
+	}
+
+	inline void interpolate8_z(double base, double step, uint32_t* out) {
+		auto bias = _mm_set1_epi32(static_cast<int>(0x80000000));
+		for (int half = 0; half < 2; ++half) {
+			auto lanes = _mm256_setr_pd(half * 4, half * 4 + 1, half * 4 + 2, half * 4 + 3);
+			auto v = _mm256_add_pd(_mm256_set1_pd(base), _mm256_mul_pd(lanes, _mm256_set1_pd(step)));
+			v = _mm256_min_pd(_mm256_max_pd(v, _mm256_setzero_pd()), _mm256_set1_pd(4294967295.0));
+			auto z = _mm256_cvttpd_epi32(_mm256_sub_pd(v, _mm256_set1_pd(2147483648.0)));
+			_mm_store_si128(reinterpret_cast<__m128i*>(out + half * 4), _mm_xor_si128(z, bias));
+		}
+	}
+#else
+	inline uint8_t coverage8(const int32_t (&e)[3], const __m128i (&lane_steps)[6]) {
+		uint8_t mask = 0;
+		for (int half = 0; half < 2; ++half) {
+			auto e0 = _mm_add_epi32(_mm_set1_epi32(e[0]), lane_steps[half * 3]);
+			auto e1 = _mm_add_epi32(_mm_set1_epi32(e[1]), lane_steps[half * 3 + 1]);
+			auto e2 = _mm_add_epi32(_mm_set1_epi32(e[2]), lane_steps[half * 3 + 2]);
+			auto outside = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+			mask |= (~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF) << (half * 4);
+		}
+		return mask;
+	}
+
+	inline void interpolate8(double base, double step, uint32_t* out) {
+		for (int half = 0; half < 2; ++half) {
+			auto lanes = _mm_setr_ps(half * 4, half * 4 + 1, half * 4 + 2, half * 4 + 3);
+			auto v = _mm_add_ps(_mm_set1_ps(static_cast<float>(base)),
+				_mm_mul_ps(lanes, _mm_set1_ps(static_cast<float>(step))));
+			v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+			_mm_store_si128(reinterpret_cast<__m128i*>(out + half * 4), _mm_cvttps_epi32(v));
+		}
+	}
+
+	inline void interpolate8_z(double base, double step, uint32_t* out) {
+		for (int lane = 0; lane < 8; ++lane) {
+			double v = std::clamp(base + step * lane, 0.0, 4294967295.0);
+			out[lane] = static_cast<uint32_t>(v);
+		}
+	}
+#endif
+}
+
+bool Gs::hiz_occluded(const Prim& prim, const Gradient& z, int origin_x, int origin_y, int x0, int y0, int x1, int y1,
+	uint32_t (&occluded)[GS_TILE_SIZE / 8]) {
+	std::fill_n(occluded, GS_TILE_SIZE / 8, 0);
+	const auto& ctx = prim.ctx;
+	uint8_t ztst = ctx.test.depth_test_method;
+	// only GEQUAL and GREATER can be decided from the smallest value of a block
+	bool test = ctx.test.depth_test_enabled && ztst >= 2;
+	bool writes = !ctx.z_buf.buf_mask;
+	if (!hiz_enabled || (!test && !writes)) {
+		return false;
+	}
+
+	uint8_t psm = GS_ZBUF_PSM(ctx.z_buf.fmt);
+	const auto& swizzle = gs_get_swizzle(psm);
+	auto z_limit = static_cast<double>(gs_psm_field(psm).mask);
+	int block_width = GS_BLOCK_SIZE * 8 / swizzle.bits / 8;
+	uint32_t bp = ctx.z_buf.base_ptr * 32;
+	auto writer = static_cast<uint32_t>(&prim - prims.data());
+	bool all = test;
+	for (int by = y0 & ~7; by <= y1; by += 8) {
+		for (int bx = x0 & -block_width; bx <= x1; bx += block_width) {
+			// a plane is lowest and highest at corners of the part of the block in the rect
+			int cx0 = std::max(bx, x0) - origin_x;
+			int cx1 = std::min(bx + block_width - 1, x1) - origin_x;
+			int cy0 = std::max(by, y0) - origin_y;
+			int cy1 = std::min(by + 7, y1) - origin_y;
+			double corners[4] {value_at(z, cx0, cy0), value_at(z, cx1, cy0), value_at(z, cx0, cy1), value_at(z, cx1, cy1)};
+			auto [low, high] = std::minmax_element(corners, corners + 4);
+			// spans step z from their first pixel, one either way covers the rounding that adds
+			auto z_min = static_cast<uint32_t>(std::clamp(*low, 0.0, z_limit));
+			auto z_max = static_cast<uint32_t>(std::clamp(*high, 0.0, z_limit));
+			z_min -= z_min > 0;
+			z_max += z_max < z_limit;
+
+			uint32_t block = gs_hiz_block(psm, gs_pixel_address(swizzle, bp, ctx.frame.buf_width, bx, by));
+			if (test) {
+				const auto& range = hiz.blocks[block];
+				// a loose range is only recomputed if the exact one could decide what it can't, a prim never occludes itself
+				bool undecided = range.min <= z_max && z_max <= range.max && range.writer != writer;
+				if (!range.valid || range.psm != psm || (range.loose && undecided)) {
+					hiz.compute(vram.data(), block, psm);
+				}
+				bool behind = ztst == 2 ? z_max < range.min : z_max <= range.min;
+				all &= behind;
+				if (behind) {
+					occluded[(by % GS_TILE_SIZE) / 8] |= ((1ULL << block_width) - 1) << (bx % GS_TILE_SIZE);
+					continue;
+				}
+			}
+			// widened up front for whatever the prim can write, the ranges stay bounds if pixels fail
+			if (writes) {
+				hiz.widen(block, psm, z_min, z_max, writer);
+			}
+		}
+	}
+	return all;
+}
+
+void Gs::draw_sprite(const Prim& prim, const Rect& clip) {
+	const auto& first = prim.vertices[0];
+	const auto& second = prim.vertices[1];
+	auto rect = clip_to_scissor(prim.ctx, clip);
+
+	// pixels whose sample point lies inside [min, max) of the 12.4 coordinates
+	int x0 = std::max<int>((std::min(first.x, second.x) + 15) >> 4, rect.x0);
+	int x1 = std::min<int>((std::max(first.x, second.x) + 15) >> 4, rect.x1 + 1);
+	int y0 = std::max<int>((std::min(first.y, second.y) + 15) >> 4, rect.y0);
+	int y1 = std::min<int>((std::max(first.y, second.y) + 15) >> 4, rect.y1 + 1);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	// clears mostly, the rect is filled a block at a time instead of going through the pipeline
+	if (prim.fill.enabled) {
+		const auto& ctx = prim.ctx;
+		gs_fill_rect(vram.data(), ctx.frame.fmt, ctx.frame.base_ptr * 32, ctx.frame.buf_width, x0, y0, x1, y1, prim.fill.frame, prim.fill.frame_keep);
+		if (!ctx.z_buf.buf_mask) {
+			gs_fill_rect(vram.data(), GS_ZBUF_PSM(ctx.z_buf.fmt), ctx.z_buf.base_ptr * 32, ctx.frame.buf_width, x0, y0, x1, y1, prim.fill.z, 0);
+			hiz.fill(GS_ZBUF_PSM(ctx.z_buf.fmt), ctx.z_buf.base_ptr * 32, ctx.frame.buf_width, x0, y0, x1, y1, prim.fill.z);
+		}
+		return;
+	}
+	uint32_t occluded[GS_TILE_SIZE / 8];
+	if (hiz_occluded(prim, {.origin = static_cast<double>(second.z)}, x0, y0, x0, y0, x1 - 1, y1 - 1, occluded)) {
+		return;
+	}
+
+	Span8 span;
+	std::fill_n(span.z, 8, second.z);
+	std::fill_n(span.r, 8, second.r);
+	std::fill_n(span.g, 8, second.g);
+	std::fill_n(span.b, 8, second.b);
+	std::fill_n(span.a, 8, second.a);
+	std::fill_n(span.fog, 8, second.fog);
+
+	bool textured = prim.texture.stage;
+	auto tex = tex_setup(prim);
+	if (textured) {
+		bool fst = tex.fst;
+		tex.coords[0] = sprite_gradient(first.x, second.x, fst ? first.u : first.s, fst ? second.u : second.s, x0, false);
+		tex.coords[1] = sprite_gradient(first.y, second.y, fst ? first.v : first.t, fst ? second.v : second.t, y0, true);
+		// q is not interpolated across sprites
+		tex.coords[2] = {.origin = second.q};
+	}
+
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; x += 8) {
+			uint8_t mask = x1 - x >= 8 ? 0xFF : (1U << (x1 - x)) - 1;
+			if ((occluded[y % GS_TILE_SIZE / 8] >> (x % GS_TILE_SIZE) & mask) == mask) {
+				continue;
+			}
+			if (textured) {
+				texcoords8(tex, x - x0, y - y0, span);
+			}
+			shade_span8(prim, x, y, mask, span);
+		}
+	}
+}
+
+void Gs::draw_point(const Prim& prim, const Rect& clip) {
+	const auto& v = prim.vertices[0];
+	auto rect = clip_to_scissor(prim.ctx, clip);
+	// the pixel nearest the vertex
+	int x = (v.x + 8) >> 4;
+	int y = (v.y + 8) >> 4;
+	if (x < rect.x0 || x > rect.x1 || y < rect.y0 || y > rect.y1) {
+		return;
+	}
+	uint32_t occluded[GS_TILE_SIZE / 8];
+	if (hiz_occluded(prim, {.origin = static_cast<double>(v.z)}, x, y, x, y, x, y, occluded)) {
+		return;
+	}
+
+	Span8 span;
+	std::fill_n(span.z, 8, v.z);
+	std::fill_n(span.r, 8, v.r);
+	std::fill_n(span.g, 8, v.g);
+	std::fill_n(span.b, 8, v.b);
+	std::fill_n(span.a, 8, v.a);
+	std::fill_n(span.fog, 8, v.fog);
+	if (prim.texture.stage) {
+		auto tex = tex_setup(prim);
+		tex.coords[0] = {.origin = tex.fst ? v.u : v.s};
+		tex.coords[1] = {.origin = tex.fst ? v.v : v.t};
+		tex.coords[2] = {.origin = v.q};
+		texcoords8(tex, 0, 0, span);
+	}
+	shade_span8(prim, x, y, 1, span);
+}
+
+void Gs::draw_line(const Prim& prim, const Rect& clip) {
+	const auto* a = &prim.vertices[0];
+	const auto* b = &prim.vertices[1];
+	int dx = b->x - a->x;
+	int dy = b->y - a->y;
+	if (!dx && !dy) {
+		return;
+	}
+	// one pixel per step along the major axis, walked forwards
+	bool vertical = std::abs(dy) > std::abs(dx);
+	if ((vertical ? dy : dx) < 0) {
+		std::swap(a, b);
+	}
+	int p0 = vertical ? a->y : a->x;
+	int p1 = vertical ? b->y : b->x;
+	int q0 = vertical ? a->x : a->y;
+	double slope = static_cast<double>(vertical ? b->x - a->x : b->y - a->y) / (p1 - p0);
+
+	// pixels whose sample point lies inside [p0, p1) on the major axis, so strips draw shared vertices once
+	auto rect = clip_to_scissor(prim.ctx, clip);
+	int first = std::max<int>((p0 + 15) >> 4, vertical ? rect.y0 : rect.x0);
+	int end = std::min<int>((p1 + 15) >> 4, (vertical ? rect.y1 : rect.x1) + 1);
+	if (first >= end) {
+		return;
+	}
+
+	// attributes only change along the major axis, the gradients take absolute pixel positions
+	auto gradient = [&](double a0, double a1) {
+		return sprite_gradient(p0, p1, a0, a1, 0, vertical);
+	};
+	auto z = gradient(a->z, b->z);
+	// the minor axis is monotonic along the line, its ends bound the rect the line covers
+	auto minor_at = [&](int m) {
+		return static_cast<int>(std::floor((q0 + (m * 16 - p0) * slope + 8) / 16));
+	};
+	int minor0 = std::max(std::min(minor_at(first), minor_at(end - 1)), static_cast<int>(vertical ? rect.x0 : rect.y0));
+	int minor1 = std::min(std::max(minor_at(first), minor_at(end - 1)), static_cast<int>(vertical ? rect.x1 : rect.y1));
+	if (minor0 > minor1) {
+		return;
+	}
+	uint32_t occluded[GS_TILE_SIZE / 8];
+	bool hidden = vertical ?
+		hiz_occluded(prim, z, 0, 0, minor0, first, minor1, end - 1, occluded) :
+		hiz_occluded(prim, z, 0, 0, first, minor0, end - 1, minor1, occluded);
+	if (hidden) {
+		return;
+	}
+	Gradient fog {};
+	bool fogging = prim.prim & GS_PRIM_FGE;
+	if (fogging) {
+		fog = gradient(a->fog, b->fog);
+	}
+
+	Span8 span;
+	Gradient colors[4] {};
+	bool gouraud = prim.prim & GS_PRIM_IIP;
+	if (gouraud) {
+		colors[0] = gradient(a->r, b->r);
+		colors[1] = gradient(a->g, b->g);
+		colors[2] = gradient(a->b, b->b);
+		colors[3] = gradient(a->a, b->a);
+	}
+	else {
+		const auto& last = prim.vertices[1];
+		std::fill_n(span.r, 8, last.r);
+		std::fill_n(span.g, 8, last.g);
+		std::fill_n(span.b, 8, last.b);
+		std::fill_n(span.a, 8, last.a);
+	}
+	bool textured = prim.texture.stage;
+	auto tex = tex_setup(prim);
+	if (textured && tex.fst) {
+		tex.coords[0] = gradient(a->u, b->u);
+		tex.coords[1] = gradient(a->v, b->v);
+	}
+	else if (textured) {
+		tex.coords[0] = gradient(a->s, b->s);
+		tex.coords[1] = gradient(a->t, b->t);
+		tex.coords[2] = gradient(a->q, b->q);
+	}
+
+	// pixels next to each other on a row share a span, steep lines shade one pixel at a time
+	int span_x = 0;
+	int span_y = 0;
+	uint8_t mask = 0;
+	auto shade = [&]() {
+		interpolate8_z(value_at(z, span_x, span_y), z.step_x, span.z);
+		if (gouraud) {
+			interpolate8(value_at(colors[0], span_x, span_y), colors[0].step_x, span.r);
+			interpolate8(value_at(colors[1], span_x, span_y), colors[1].step_x, span.g);
+			interpolate8(value_at(colors[2], span_x, span_y), colors[2].step_x, span.b);
+			interpolate8(value_at(colors[3], span_x, span_y), colors[3].step_x, span.a);
+		}
+		if (fogging) {
+			interpolate8(value_at(fog, span_x, span_y), fog.step_x, span.fog);
+		}
+		if (textured) {
+			texcoords8(tex, span_x, span_y, span);
+		}
+		shade_span8(prim, span_x, span_y, mask, span);
+		mask = 0;
+	};
+	for (int m = first; m < end; ++m) {
+		// the minor axis rounds to the nearest pixel
+		int n = minor_at(m);
+		int x = vertical ? n : m;
+		int y = vertical ? m : n;
+		if (x < rect.x0 || x > rect.x1 || y < rect.y0 || y > rect.y1) {
+			continue;
+		}
+		if (mask && (y != span_y || x - span_x >= 8)) {
+			shade();
+		}
+		if (!mask) {
+			span_x = x;
+			span_y = y;
+		}
+		mask |= 1U << (x - span_x);
+	}
+	if (mask) {
+		shade();
+	}
+}
+
+namespace {
+	bool setup_triangle(const Gs::Prim& prim, Gs::TriangleSetup& setup) {
+		Gs::Vertex v[3] {prim.vertices[0], prim.vertices[1], prim.vertices[2]};
+		int64_t area = orient_2d(v[0], v[1], v[2].x, v[2].y);
+		if (area == 0) {
+			return false;
+		}
+		// make the winding clockwise in screen space so inside is where every edge is positive
+		if (area < 0) {
+			std::swap(v[1], v[2]);
+			area = -area;
+		}
+
+		int x0 = (std::min({v[0].x, v[1].x, v[2].x}) + 15) >> 4;
+		int y0 = (std::min({v[0].y, v[1].y, v[2].y}) + 15) >> 4;
+		setup.x0 = static_cast<int16_t>(x0);
+		setup.y0 = static_cast<int16_t>(y0);
+		setup.x1 = static_cast<int16_t>(std::max({v[0].x, v[1].x, v[2].x}) >> 4);
+		setup.y1 = static_cast<int16_t>(std::max({v[0].y, v[1].y, v[2].y}) >> 4);
+
+		// edge i is opposite vertex i
+		// strips and fans share one edge with the previous triangle, but it would still need moving to this
+		// triangle's origin, which costs about as much as setting it up again
+		setup.edges[0] = setup_edge(v[1], v[2], x0, y0);
+		setup.edges[1] = setup_edge(v[2], v[0], x0, y0);
+		setup.edges[2] = setup_edge(v[0], v[1], x0, y0);
+
+		// the unbiased edge functions are the barycentric weights
+		Edge weights[3];
+		for (int i = 0; i < 3; ++i) {
+			weights[i] = setup.edges[i];
+			weights[i].origin = orient_2d(v[(i + 1) % 3], v[(i + 2) % 3], x0 * 16, y0 * 16);
+		}
+		auto fa = static_cast<double>(area);
+		auto gradient = [&](double a0, double a1, double a2) {
+			return setup_gradient(weights, fa, a0, a1, a2);
+		};
+		setup.z = gradient(v[0].z, v[1].z, v[2].z);
+		if (prim.prim & GS_PRIM_FGE) {
+			setup.fog = gradient(v[0].fog, v[1].fog, v[2].fog);
+		}
+		if (prim.prim & GS_PRIM_IIP) {
+			setup.colors[0] = gradient(v[0].r, v[1].r, v[2].r);
+			setup.colors[1] = gradient(v[0].g, v[1].g, v[2].g);
+			setup.colors[2] = gradient(v[0].b, v[1].b, v[2].b);
+			setup.colors[3] = gradient(v[0].a, v[1].a, v[2].a);
+		}
+		if (prim.texture.stage && (prim.prim & GS_PRIM_FST)) {
+			setup.tex[0] = gradient(v[0].u, v[1].u, v[2].u);
+			setup.tex[1] = gradient(v[0].v, v[1].v, v[2].v);
+		}
+		else if (prim.texture.stage) {
+			setup.tex[0] = gradient(v[0].s, v[1].s, v[2].s);
+			setup.tex[1] = gradient(v[0].t, v[1].t, v[2].t);
+			setup.tex[2] = gradient(v[0].q, v[1].q, v[2].q);
+		}
+		return true;
+	}
+}
+
+void Gs::draw_triangle(const Prim& prim, const Rect& clip) {
+	const auto& setup = triangle_setups[prim.setup];
+	auto rect = clip_to_scissor(prim.ctx, clip);
+	int x0 = std::max<int>(setup.x0, rect.x0);
+	int y0 = std::max<int>(setup.y0, rect.y0);
+	int x1 = std::min<int>(setup.x1, rect.x1);
+	int y1 = std::min<int>(setup.y1, rect.y1);
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+	// spans in blocks the triangle is behind everywhere are skipped, all of it if that is every block
+	uint32_t occluded[GS_TILE_SIZE / 8];
+	if (hiz_occluded(prim, setup.z, setup.x0, setup.y0, x0, y0, x1, y1, occluded)) {
+		return;
+	}
+
+	// the edges are walked from the first pixel of the clipped box, the gradients from the setup's origin
+	Edge edges[3];
+	for (int i = 0; i < 3; ++i) {
+		edges[i] = setup.edges[i];
+		edges[i].origin += edges[i].step_x * (x0 - setup.x0) + edges[i].step_y * (y0 - setup.y0);
+	}
+
+	Span8 span;
+	bool fogging = prim.prim & GS_PRIM_FGE;
+	bool gouraud = prim.prim & GS_PRIM_IIP;
+	if (!gouraud) {
+		// flat shading takes the color of the last vertex kicked
+		const auto& last = prim.vertices[2];
+		std::fill_n(span.r, 8, last.r);
+		std::fill_n(span.g, 8, last.g);
+		std::fill_n(span.b, 8, last.b);
+		std::fill_n(span.a, 8, last.a);
+	}
+	bool textured = prim.texture.stage;
+	auto tex = tex_setup(prim);
+	std::copy_n(setup.tex, 3, tex.coords);
+
+	// 32-bit lanes are enough unless the edge functions get huge over the
+	// bounding box, the functions are linear so the corners bound them
+	bool fits_32 = true;
+	for (const auto& edge : edges) {
+		for (int corner = 0; corner < 4; ++corner) {
+			int64_t dx = corner & 1 ? x1 - x0 + 7 : 0;
+			int64_t dy = corner & 2 ? y1 - y0 : 0;
+			int64_t value = edge.origin + edge.step_x * dx + edge.step_y * dy;
+			if (value < std::numeric_limits<int32_t>::min() || value > std::numeric_limits<int32_t>::max()) {
+				fits_32 = false;
+			}
+		}
+	}
+
+#ifdef __AVX2__
+	__m256i lane_steps[3];
+	for (int i = 0; i < 3; ++i) {
+		auto step = static_cast<int32_t>(edges[i].step_x);
+		lane_steps[i] = _mm256_mullo_epi32(_mm256_set1_epi32(step), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	}
+#else
+	__m128i lane_steps[6];
+	for (int half = 0; half < 2; ++half) {
+		for (int i = 0; i < 3; ++i) {
+			auto step = static_cast<int32_t>(edges[i].step_x);
+			lane_steps[half * 3 + i] = _mm_setr_epi32(
+				step * (half * 4), step * (half * 4 + 1), step * (half * 4 + 2), step * (half * 4 + 3));
+		}
+	}
+#endif
+
+	for (int y = y0; y <= y1; ++y) {
+		int64_t row[3];
+		for (int i = 0; i < 3; ++i) {
+			row[i] = edges[i].origin + edges[i].step_y * (y - y0);
+		}
+
+		bool entered = false;
+		for (int x = x0; x <= x1; x += 8) {
+			uint8_t mask;
+			if (fits_32) {
+				int32_t e[3];
+				for (int i = 0; i < 3; ++i) {
+					e[i] = static_cast<int32_t>(row[i] + edges[i].step_x * (x - x0));
+				}
+				mask = coverage8(e, lane_steps);
+			}
+			else {
+				mask = 0;
+				for (int lane = 0; lane < 8; ++lane) {
+					bool inside = true;
+					for (int i = 0; i < 3; ++i) {
+						inside &= row[i] + edges[i].step_x * (x - x0 + lane) >= 0;
+					}
+					mask |= inside << lane;
+				}
+			}
+			if (x1 - x < 7) {
+				mask &= (1U << (x1 - x + 1)) - 1;
+			}
+
+			if (!mask) {
+				// triangles are convex, nothing more on this row once we left it
+				if (entered) {
+					break;
+				}
+				continue;
+			}
+			entered = true;
+			if ((occluded[y % GS_TILE_SIZE / 8] >> (x % GS_TILE_SIZE) & mask) == mask) {
+				continue;
+			}
+
+			int dx = x - setup.x0;
+			int dy = y - setup.y0;
+			interpolate8_z(value_at(setup.z, dx, dy), setup.z.step_x, span.z);
+			if (gouraud) {
+				interpolate8(value_at(setup.colors[0], dx, dy), setup.colors[0].step_x, span.r);
+				interpolate8(value_at(setup.colors[1], dx, dy), setup.colors[1].step_x, span.g);
+				interpolate8(value_at(setup.colors[2], dx, dy), setup.colors[2].step_x, span.b);
+				interpolate8(value_at(setup.colors[3], dx, dy), setup.colors[3].step_x, span.a);
+			}
+			if (fogging) {
+				interpolate8(value_at(setup.fog, dx, dy), setup.fog.step_x, span.fog);
+			}
+			if (textured) {
+				texcoords8(tex, dx, dy, span);
+			}
+			shade_span8(prim, x, y, mask, span);
+		}
+	}
+}
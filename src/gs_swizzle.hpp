@@ -0,0 +1,182 @@
+#pragma once
+#include <cstdint>
+
+// pixel storage formats
+#define GS_PSMCT32 0x00
+#define GS_PSMCT24 0x01
+#define GS_PSMCT16 0x02
+#define GS_PSMCT16S 0x0A
+#define GS_PSMT8 0x13
+#define GS_PSMT4 0x14
+#define GS_PSMT8H 0x1B
+#define GS_PSMT4HL 0x24
+#define GS_PSMT4HH 0x2C
+#define GS_PSMZ32 0x30
+#define GS_PSMZ24 0x31
+#define GS_PSMZ16 0x32
+#define GS_PSMZ16S 0x3A
+
+#define GS_VRAM_SIZE (4 * 1024 * 1024)
+#define GS_BLOCK_SIZE 256
+#define GS_PAGE_SIZE 8192
+
+// vram addressing of one format, offsets are in units of the format's pixel size
+struct GsSwizzle {
+	uint8_t bits;
+	uint8_t page_width_shift;
+	uint8_t page_height_shift;
+	// the offset of a pixel within its page is row[y] ^ col[x]
+	uint32_t row[128];
+	uint32_t col[128];
+};
+
+namespace gs_swizzle {
+	// blocks of a page, in rows of blocks
+	constexpr uint8_t BLOCKS_32[4][8] {
+		{0, 1, 4, 5, 16, 17, 20, 21},
+		{2, 3, 6, 7, 18, 19, 22, 23},
+		{8, 9, 12, 13, 24, 25, 28, 29},
+		{10, 11, 14, 15, 26, 27, 30, 31}
+	};
+	constexpr uint8_t BLOCKS_16[8][4] {
+		{0, 2, 8, 10},
+		{1, 3, 9, 11},
+		{4, 6, 12, 14},
+		{5, 7, 13, 15},
+		{16, 18, 24, 26},
+		{17, 19, 25, 27},
+		{20, 22, 28, 30},
+		{21, 23, 29, 31}
+	};
+	constexpr uint8_t BLOCKS_16S[8][4] {
+		{0, 2, 16, 18},
+		{1, 3, 17, 19},
+		{8, 10, 24, 26},
+		{9, 11, 25, 27},
+		{4, 6, 20, 22},
+		{5, 7, 21, 23},
+		{12, 14, 28, 30},
+		{13, 15, 29, 31}
+	};
+	// z buffers use the color block order with the block bits flipped
+	constexpr uint32_t Z_BLOCK_XOR = 24;
+
+	enum class Layout {
+		Bits32,
+		Bits16,
+		Bits16S,
+		Bits8,
+		Bits4
+	};
+
+	// word of a 64-byte column that holds pixel xi of a column row
+	constexpr uint32_t column_word(uint32_t xi, uint32_t r) {
+		return (xi >> 1 & 1) * 4 + (xi & 1) + (xi >> 2) * 8 + r * 2;
+	}
+
+	constexpr uint32_t page_offset(Layout layout, uint32_t block_xor, uint32_t x, uint32_t y) {
+		if (layout == Layout::Bits32) {
+			uint32_t block = BLOCKS_32[y / 8][x / 8] ^ block_xor;
+			return block * 64 + (y % 8 >> 1) * 16 + column_word(x % 8, y & 1);
+		}
+		else if (layout == Layout::Bits16 || layout == Layout::Bits16S) {
+			auto& blocks = layout == Layout::Bits16 ? BLOCKS_16 : BLOCKS_16S;
+			uint32_t block = blocks[y / 8][x / 16] ^ block_xor;
+			uint32_t bx = x % 16;
+			return block * 128 + (y % 8 >> 1) * 32 + column_word(bx & 7, y & 1) * 2 + (bx >> 3);
+		}
+
+		// 8 and 4-bit columns alternate which half of the words their rows start in
+		bool bits8 = layout == Layout::Bits8;
+		uint32_t block = bits8 ? BLOCKS_32[y / 16][x / 16] : BLOCKS_16[y / 16][x / 32];
+		uint32_t bx = x % (bits8 ? 16 : 32);
+		uint32_t column = y % 16 >> 2;
+		uint32_t r = y & 3;
+		uint32_t xi = (bx & 7) ^ (((r >> 1) ^ (column & 1)) ? 4 : 0);
+		uint32_t per_word = bits8 ? 4 : 8;
+		return block * 64 * per_word + column * 16 * per_word + column_word(xi, r & 1) * per_word + 2 * (bx >> 3) + (r >> 1);
+	}
+
+	constexpr GsSwizzle make(Layout layout, uint32_t block_xor) {
+		GsSwizzle swizzle {};
+		swizzle.bits = layout == Layout::Bits32 ? 32 : layout == Layout::Bits8 ? 8 : layout == Layout::Bits4 ? 4 : 16;
+		swizzle.page_width_shift = layout == Layout::Bits8 || layout == Layout::Bits4 ? 7 : 6;
+		swizzle.page_height_shift = layout == Layout::Bits32 ? 5 : layout == Layout::Bits4 ? 7 : 6;
+		for (uint32_t i = 0; i < 128; ++i) {
+			swizzle.row[i] = i < 1U << swizzle.page_height_shift ? page_offset(layout, block_xor, 0, i) : 0;
+			// the block flip is applied once, through the row table
+			swizzle.col[i] = i < 1U << swizzle.page_width_shift ? page_offset(layout, 0, i, 0) : 0;
+		}
+		return swizzle;
+	}
+
+	// the tables are only usable if the layout really is separable like this
+	constexpr bool matches(const GsSwizzle& swizzle, Layout layout, uint32_t block_xor) {
+		for (uint32_t y = 0; y < 1U << swizzle.page_height_shift; ++y) {
+			for (uint32_t x = 0; x < 1U << swizzle.page_width_shift; ++x) {
+				if ((swizzle.row[y] ^ swizzle.col[x]) != page_offset(layout, block_xor, x, y)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+}
+
+inline constexpr GsSwizzle GS_SWIZZLE_32 = gs_swizzle::make(gs_swizzle::Layout::Bits32, 0);
+inline constexpr GsSwizzle GS_SWIZZLE_32Z = gs_swizzle::make(gs_swizzle::Layout::Bits32, gs_swizzle::Z_BLOCK_XOR);
+inline constexpr GsSwizzle GS_SWIZZLE_16 = gs_swizzle::make(gs_swizzle::Layout::Bits16, 0);
+inline constexpr GsSwizzle GS_SWIZZLE_16S = gs_swizzle::make(gs_swizzle::Layout::Bits16S, 0);
+inline constexpr GsSwizzle GS_SWIZZLE_16Z = gs_swizzle::make(gs_swizzle::Layout::Bits16, gs_swizzle::Z_BLOCK_XOR);
+inline constexpr GsSwizzle GS_SWIZZLE_16SZ = gs_swizzle::make(gs_swizzle::Layout::Bits16S, gs_swizzle::Z_BLOCK_XOR);
+inline constexpr GsSwizzle GS_SWIZZLE_8 = gs_swizzle::make(gs_swizzle::Layout::Bits8, 0);
+inline constexpr GsSwizzle GS_SWIZZLE_4 = gs_swizzle::make(gs_swizzle::Layout::Bits4, 0);
+
+static_assert(gs_swizzle::matches(GS_SWIZZLE_32, gs_swizzle::Layout::Bits32, 0));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_32Z, gs_swizzle::Layout::Bits32, gs_swizzle::Z_BLOCK_XOR));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_16, gs_swizzle::Layout::Bits16, 0));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_16S, gs_swizzle::Layout::Bits16S, 0));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_16Z, gs_swizzle::Layout::Bits16, gs_swizzle::Z_BLOCK_XOR));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_16SZ, gs_swizzle::Layout::Bits16S, gs_swizzle::Z_BLOCK_XOR));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_8, gs_swizzle::Layout::Bits8, 0));
+static_assert(gs_swizzle::matches(GS_SWIZZLE_4, gs_swizzle::Layout::Bits4, 0));
+// spot checks against the hardware column layouts
+static_assert(GS_SWIZZLE_8.row[2] == 33 && (GS_SWIZZLE_8.row[2] ^ GS_SWIZZLE_8.col[4]) == 1);
+static_assert(GS_SWIZZLE_4.row[2] == 65 && (GS_SWIZZLE_4.row[2] ^ GS_SWIZZLE_4.col[31]) == 47);
+static_assert(GS_SWIZZLE_16.col[8] == 1 && GS_SWIZZLE_16.col[7] == 26);
+
+// the address tables of psm, the 24-bit and high bit formats share the 32-bit layout
+constexpr const GsSwizzle& gs_get_swizzle(uint8_t psm) {
+	switch (psm) {
+		case GS_PSMCT16:
+			return GS_SWIZZLE_16;
+		case GS_PSMCT16S:
+			return GS_SWIZZLE_16S;
+		case GS_PSMT8:
+			return GS_SWIZZLE_8;
+		case GS_PSMT4:
+			return GS_SWIZZLE_4;
+		case GS_PSMZ32:
+		case GS_PSMZ24:
+			return GS_SWIZZLE_32Z;
+		case GS_PSMZ16:
+			return GS_SWIZZLE_16Z;
+		case GS_PSMZ16S:
+			return GS_SWIZZLE_16SZ;
+		default:
+			return GS_SWIZZLE_32;
+	}
+}
+
+// address of pixel (x, y) in units of the format's pixel size
+// bp is in 256-byte blocks and bw in 64-pixel units
+inline uint32_t gs_pixel_address(const GsSwizzle& swizzle, uint32_t bp, uint32_t bw, uint32_t x, uint32_t y) {
+	uint32_t pixels_per_block = GS_BLOCK_SIZE * 8 / swizzle.bits;
+	uint32_t pages_per_row = (bw * 64) >> swizzle.page_width_shift;
+	uint32_t page = (y >> swizzle.page_height_shift) * pages_per_row + (x >> swizzle.page_width_shift);
+	uint32_t page_mask_x = (1U << swizzle.page_width_shift) - 1;
+	uint32_t page_mask_y = (1U << swizzle.page_height_shift) - 1;
+	uint32_t address = bp * pixels_per_block + page * pixels_per_block * 32;
+	address += swizzle.row[y & page_mask_y] ^ swizzle.col[x & page_mask_x];
+	return address & (GS_VRAM_SIZE * 8 / swizzle.bits - 1);
+}
@@ -0,0 +1,373 @@
+#include "gs_texture.hpp"
+#include "gs.hpp"
+#include "gs_pixel.hpp"
+#include "gs_format.hpp"
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <utility>
+
+namespace {
+	bool is_indexed(uint8_t psm) {
+		return psm == GS_PSMT8 || psm == GS_PSMT4 || psm == GS_PSMT8H || psm == GS_PSMT4HL || psm == GS_PSMT4HH;
+	}
+
+	bool uses_texa(uint8_t psm) {
+		return psm == GS_PSMCT24 || psm == GS_PSMCT16 || psm == GS_PSMCT16S ||
+			psm == GS_PSMZ24 || psm == GS_PSMZ16 || psm == GS_PSMZ16S;
+	}
+
+	// TEXA supplies the alpha of 24 and 16-bit texels, aem makes black transparent
+	uint32_t expand_alpha(const GsTextureKey& key, uint8_t psm, uint32_t color) {
+		if (psm == GS_PSMZ16 || psm == GS_PSMZ16S) {
+			// z formats read back as plain integers
+			color = gs_expand16(color);
+		}
+		uint32_t rgb = color & 0xFFFFFF;
+		if (psm == GS_PSMCT24 || psm == GS_PSMZ24) {
+			return rgb | (key.aem && !rgb ? 0 : key.ta0) << 24;
+		}
+		else if (uses_texa(psm)) {
+			if (color >> 24) {
+				return rgb | key.ta1 << 24;
+			}
+			return rgb | (key.aem && !rgb ? 0 : key.ta0) << 24;
+		}
+		return color;
+	}
+
+	bool is_4bit(uint8_t psm) {
+		return psm == GS_PSMT4 || psm == GS_PSMT4HL || psm == GS_PSMT4HH;
+	}
+
+	// buffer slot of entry i, 32-bit entries only have 256 slots for their low halves
+	uint32_t clut_slot(uint8_t cpsm, uint8_t csa, uint32_t i) {
+		return (csa * 16 + i) & (cpsm == GS_PSMCT32 ? 0xFF : 0x1FF);
+	}
+
+	void read_palette(const GsClut& clut, const GsTextureKey& key, uint32_t* palette) {
+		uint32_t count = is_4bit(key.psm) ? 16 : 256;
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t slot = clut_slot(key.cpsm, key.csa, i);
+			uint32_t color = key.cpsm == GS_PSMCT32 ?
+				clut.entries[slot] | clut.entries[slot + 256] << 16 :
+				gs_expand16(clut.entries[slot]);
+			palette[i] = expand_alpha(key, key.cpsm, color);
+		}
+	}
+
+	void decode(const uint8_t* vram, const GsClut& clut, const GsTextureKey& key, uint32_t* texels) {
+		uint32_t width = 1U << key.tw;
+		uint32_t height = 1U << key.th;
+		bool indexed = is_indexed(key.psm);
+		uint32_t palette[256] {};
+		if (indexed) {
+			read_palette(clut, key, palette);
+		}
+
+		for (uint32_t y = 0; y < height; ++y) {
+			uint32_t* row = texels + y * width;
+			gs_read_span(vram, key.psm, key.tbp, key.tbw, 0, y, width, row);
+			for (uint32_t x = 0; x < width; ++x) {
+				row[x] = indexed ? palette[row[x]] : expand_alpha(key, key.psm, row[x]);
+			}
+		}
+	}
+
+	int32_t wrap_coord(uint8_t mode, int32_t coord, int32_t size, int32_t min, int32_t max) {
+		// REPEAT
+		if (mode == 0) {
+			return coord & (size - 1);
+		}
+		// CLAMP
+		else if (mode == 1) {
+			return std::clamp(coord, 0, size - 1);
+		}
+		// REGION_CLAMP
+		else if (mode == 2) {
+			return std::clamp(std::min(std::max(coord, min), max), 0, size - 1);
+		}
+		// REGION_REPEAT, min and max are a mask and the bits to set
+		return ((coord & min) | max) & (size - 1);
+	}
+
+	template<uint8_t Tfx, bool Tcc, uint8_t WrapU, uint8_t WrapV>
+	void texture_stage(const Gs::Prim& prim, Gs::Span8& span) {
+		const auto& wrap = prim.ctx.tex_wrap_mode;
+		int32_t width = 1 << std::min<uint8_t>(prim.ctx.tex.width, 10);
+		int32_t height = 1 << std::min<uint8_t>(prim.ctx.tex.height, 10);
+		for (int lane = 0; lane < 8; ++lane) {
+			int32_t u = wrap_coord(WrapU, span.u[lane], width, wrap.u_clamp_min, wrap.u_clamp_max);
+			int32_t v = wrap_coord(WrapV, span.v[lane], height, wrap.v_clamp_min, wrap.v_clamp_max);
+			uint32_t texel = prim.texture.texels[v * width + u];
+
+			uint32_t* colors[3] {&span.r[lane], &span.g[lane], &span.b[lane]};
+			uint32_t alpha = span.a[lane];
+			uint32_t texel_alpha = texel >> 24;
+			for (int ch = 0; ch < 3; ++ch) {
+				uint32_t texel_color = texel >> (ch * 8) & 0xFF;
+				// MODULATE
+				if constexpr (Tfx == 0) {
+					*colors[ch] = std::min((texel_color * *colors[ch]) >> 7, 255U);
+				}
+				// DECAL
+				else if constexpr (Tfx == 1) {
+					*colors[ch] = texel_color;
+				}
+				// HIGHLIGHT, HIGHLIGHT2
+				else {
+					*colors[ch] = std::min(((texel_color * *colors[ch]) >> 7) + alpha, 255U);
+				}
+			}
+
+			// without TCC the vertex alpha is kept
+			if constexpr (Tcc) {
+				if constexpr (Tfx == 0) {
+					span.a[lane] = std::min((texel_alpha * alpha) >> 7, 255U);
+				}
+				else if constexpr (Tfx == 2) {
+					span.a[lane] = std::min(texel_alpha + alpha, 255U);
+				}
+				else {
+					span.a[lane] = texel_alpha;
+				}
+			}
+		}
+	}
+
+	// table index: tfx, tcc, wms, wmt
+	constexpr size_t TEXTURE_STAGE_COUNT = 4 * 2 * 4 * 4;
+
+	template<size_t Index>
+	constexpr Gs::TextureStage make_texture_stage() {
+		constexpr uint8_t wrap_v = Index % 4;
+		constexpr uint8_t wrap_u = Index / 4 % 4;
+		constexpr bool tcc = Index / 16 % 2;
+		constexpr uint8_t tfx = Index / 32;
+		return texture_stage<tfx, tcc, wrap_u, wrap_v>;
+	}
+
+	template<size_t... I>
+	constexpr std::array<Gs::TextureStage, TEXTURE_STAGE_COUNT> make_texture_stage_table(std::index_sequence<I...>) {
+		return {make_texture_stage<I>()...};
+	}
+
+	constexpr auto TEXTURE_STAGES = make_texture_stage_table(std::make_index_sequence<TEXTURE_STAGE_COUNT> {});
+}
+
+void gs_mark_pages(GsPageSet& pages, uint8_t psm, uint32_t bp, uint32_t bw, int x0, int y0, int x1, int y1) {
+	x1 = std::min(x1, 2047);
+	y1 = std::min(y1, 2047);
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	// same page arithmetic as gs_pixel_address, a buffer not starting on a page spills into the next one
+	const auto& swizzle = gs_get_swizzle(psm);
+	uint32_t pages_per_row = (bw * 64) >> swizzle.page_width_shift;
+	uint32_t first = bp / 32;
+	uint32_t spill = bp % 32 ? 1 : 0;
+	for (uint32_t py = y0 >> swizzle.page_height_shift; py <= static_cast<uint32_t>(y1) >> swizzle.page_height_shift; ++py) {
+		for (uint32_t px = x0 >> swizzle.page_width_shift; px <= static_cast<uint32_t>(x1) >> swizzle.page_width_shift; ++px) {
+			uint32_t page = first + py * pages_per_row + px;
+			for (uint32_t i = 0; i <= spill; ++i) {
+				pages.set((page + i) % pages.size());
+			}
+		}
+	}
+}
+
+size_t GsTextureKeyHash::operator()(const GsTextureKey& key) const {
+	uint64_t texture = key.tbp | key.tbw << 16 | static_cast<uint64_t>(key.psm) << 24 | static_cast<uint64_t>(key.tw) << 32 |
+		static_cast<uint64_t>(key.th) << 40;
+	uint64_t clut = key.clut_generation | static_cast<uint64_t>(key.cpsm) << 32 | static_cast<uint64_t>(key.csa) << 40 |
+		static_cast<uint64_t>(key.ta0) << 48 | static_cast<uint64_t>(key.ta1) << 56;
+	clut ^= static_cast<uint64_t>(key.aem) << 63;
+	return std::hash<uint64_t> {}(texture * 0x9E3779B97F4A7C15ULL ^ clut);
+}
+
+GsPageSet gs_texture_pages(const GsTextureKey& key) {
+	GsPageSet pages;
+	gs_mark_pages(pages, key.psm, key.tbp, key.tbw, 0, 0, (1 << key.tw) - 1, (1 << key.th) - 1);
+	return pages;
+}
+
+GsPageSet gs_clut_pages(const GsClutSource& source) {
+	GsPageSet pages;
+	if (source.csm2) {
+		int x = source.cou * 16;
+		int count = source.bits4 ? 16 : 256;
+		gs_mark_pages(pages, source.cpsm, source.cbp, source.cbw, x, source.cov, x + count - 1, source.cov);
+	}
+	else {
+		gs_mark_pages(pages, source.cpsm, source.cbp, 1, 0, 0, 15, 15);
+	}
+	return pages;
+}
+
+void GsClut::load(const uint8_t* vram, const GsClutSource& load_source) {
+	uint32_t count = load_source.bits4 ? 16 : 256;
+	uint32_t colors[256];
+	if (load_source.csm2) {
+		gs_read_span(vram, load_source.cpsm, load_source.cbp, load_source.cbw, load_source.cou * 16, load_source.cov, count, colors);
+	}
+	else {
+		uint32_t columns = load_source.bits4 ? 8 : 16;
+		uint32_t row[16];
+		for (uint32_t y = 0; y < count / columns; ++y) {
+			gs_read_span(vram, load_source.cpsm, load_source.cbp, 1, 0, y, columns, row);
+			for (uint32_t x = 0; x < columns; ++x) {
+				uint32_t index = y * columns + x;
+				if (!load_source.bits4) {
+					index = (index & ~0x18U) | (index & 0x8) << 1 | (index & 0x10) >> 1;
+				}
+				colors[index] = row[x];
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t slot = clut_slot(load_source.cpsm, load_source.csa, i);
+		if (load_source.cpsm == GS_PSMCT32) {
+			entries[slot] = colors[i] & 0xFFFF;
+			entries[slot + 256] = colors[i] >> 16;
+		}
+		else {
+			entries[slot] = gs_pack16(colors[i]);
+		}
+	}
+
+	source = load_source;
+	pages = gs_clut_pages(load_source);
+	valid = true;
+	++generation;
+}
+
+const uint32_t* GsTextureCache::lookup(const uint8_t* vram, const GsClut& clut, const GsTextureKey& key) {
+	auto [it, inserted] = textures.try_emplace(key);
+	auto& texture = it->second;
+	texture.last_use = ++clock;
+	if (inserted) {
+		texture.pages = gs_texture_pages(key);
+		texture.texels.resize(size_t {1} << (key.tw + key.th));
+		decode(vram, clut, key, texture.texels.data());
+		texel_count += texture.texels.size();
+	}
+	return texture.texels.data();
+}
+
+void GsTextureCache::invalidate(const GsPageSet& pages) {
+	std::erase_if(textures, [&](const auto& entry) {
+		if ((entry.second.pages & pages).none()) {
+			return false;
+		}
+		texel_count -= entry.second.texels.size();
+		return true;
+	});
+}
+
+void GsTextureCache::trim() {
+	while (texel_count > GS_TEXTURE_CACHE_TEXELS) {
+		auto oldest = std::min_element(textures.begin(), textures.end(), [](const auto& a, const auto& b) {
+			return a.second.last_use < b.second.last_use;
+		});
+		texel_count -= oldest->second.texels.size();
+		textures.erase(oldest);
+	}
+}
+
+Gs::TextureStage get_gs_texture_stage(const Gs::Context& ctx) {
+	size_t index = ctx.tex.color_func;
+	index = index * 2 + ctx.tex.alpha_ctrl;
+	index = index * 4 + ctx.tex_wrap_mode.hz_wrap_mode;
+	index = index * 4 + ctx.tex_wrap_mode.vt_wrap_mode;
+	return TEXTURE_STAGES[index];
+}
+
+Gs::TextureState Gs::bind_texture(const Context& ctx, GsPageSet& pages) {
+	GsTextureKey key {
+		.tbp = ctx.tex.base_ptr,
+		.tbw = ctx.tex.buf_width,
+		.psm = ctx.tex.fmt,
+		.tw = std::min<uint8_t>(ctx.tex.width, 10),
+		.th = std::min<uint8_t>(ctx.tex.height, 10)
+	};
+	if (is_indexed(key.psm)) {
+		key.clut_generation = clut.generation;
+		key.cpsm = ctx.tex.clut_fmt;
+		key.csa = ctx.tex.clut_entry_off;
+	}
+	// only the formats TEXA applies to depend on it
+	if (uses_texa(is_indexed(key.psm) ? key.cpsm : key.psm)) {
+		key.ta0 = texa.ta0;
+		key.ta1 = texa.ta1;
+		key.aem = texa.aem;
+	}
+
+	// textures written since they were decoded are decoded again once the prims writing them are drawn
+	pages = gs_texture_pages(key);
+	if ((vram_dirty & pages).any()) {
+		invalidate_dirty_pages();
+	}
+
+	return {
+		.stage = get_gs_texture_stage(ctx),
+		.texels = textures.lookup(vram.data(), clut, key)
+	};
+}
+
+void Gs::invalidate_dirty_pages() {
+	flush();
+	draw_state.valid = false;
+	textures.invalidate(vram_dirty);
+	if ((clut.pages & vram_dirty).any()) {
+		clut.valid = false;
+	}
+	vram_dirty.reset();
+}
+
+void Gs::update_clut(const Context& ctx) {
+	if (!is_indexed(ctx.tex.fmt)) {
+		return;
+	}
+
+	// CLD
+	uint8_t cld = ctx.tex.clut_cache_ctrl;
+	uint16_t cbp = ctx.tex.clut_base_ptr;
+	bool load = cld == 1 || cld == 2 || cld == 3 ||
+		(cld == 4 && cbp != clut_cbp[0]) ||
+		(cld == 5 && cbp != clut_cbp[1]);
+	if (cld == 2 || cld == 4) {
+		clut_cbp[0] = cbp;
+	}
+	else if (cld == 3 || cld == 5) {
+		clut_cbp[1] = cbp;
+	}
+	if (!load) {
+		return;
+	}
+
+	GsClutSource source {
+		.cbp = cbp,
+		.cpsm = ctx.tex.clut_fmt,
+		.csm2 = ctx.tex.clut_csm2,
+		.csa = ctx.tex.clut_entry_off,
+		.bits4 = is_4bit(ctx.tex.fmt)
+	};
+	if (source.csm2) {
+		source.cbw = texclut.cbw;
+		source.cou = texclut.cou;
+		source.cov = texclut.cov;
+	}
+
+	// the entries drawn so far have to land before they are read
+	if ((vram_dirty & gs_clut_pages(source)).any()) {
+		invalidate_dirty_pages();
+	}
+
+	// reloading what the buffer already holds would change nothing
+	if (clut.valid && clut.source == source) {
+		return;
+	}
+	clut.load(vram.data(), source);
+}
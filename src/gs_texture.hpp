@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+#include "gs_swizzle.hpp"
+
+// decoded texels kept before the least recently used textures are evicted
+#define GS_TEXTURE_CACHE_TEXELS (16 * 1024 * 1024)
+
+// one bit per page of vram
+using GsPageSet = std::bitset<GS_VRAM_SIZE / GS_PAGE_SIZE>;
+
+// sets the pages holding the pixels (x0, y0) to (x1, y1) inclusive of a buffer, nothing if the rect is empty
+void gs_mark_pages(GsPageSet& pages, uint8_t psm, uint32_t bp, uint32_t bw, int x0, int y0, int x1, int y1);
+
+// everything the decoded texels of a texture depend on besides vram
+struct GsTextureKey {
+	uint16_t tbp;
+	uint8_t tbw;
+	uint8_t psm;
+	// log2 of the size, at most 10
+	uint8_t tw;
+	uint8_t th;
+	// indexed textures take their palette from the clut buffer as of this load
+	uint32_t clut_generation;
+	uint8_t cpsm;
+	uint8_t csa;
+	uint8_t ta0;
+	uint8_t ta1;
+	bool aem;
+
+	bool operator==(const GsTextureKey& other) const = default;
+};
+
+struct GsTextureKeyHash {
+	size_t operator()(const GsTextureKey& key) const;
+};
+
+// pages the texels of a texture are read from
+GsPageSet gs_texture_pages(const GsTextureKey& key);
+
+// where a clut load reads its entries from
+struct GsClutSource {
+	uint16_t cbp;
+	uint8_t cpsm;
+	bool csm2;
+	uint8_t csa;
+	// 16 entries for 4-bit textures, otherwise 256
+	bool bits4;
+	// TEXCLUT, only used by csm2
+	uint8_t cbw;
+	uint8_t cou;
+	uint16_t cov;
+
+	bool operator==(const GsClutSource& other) const = default;
+};
+
+GsPageSet gs_clut_pages(const GsClutSource& source);
+
+// the clut buffer, 512 16-bit entries where 32-bit colors keep their high halves 256 entries up
+struct GsClut {
+	uint16_t entries[512];
+	// the last load, valid until one of its pages is written
+	GsClutSource source;
+	GsPageSet pages;
+	bool valid;
+	// bumped whenever the entries change
+	uint32_t generation;
+
+	// copies the entries of source from vram, csm1 reads a 16x16 rect (8x2 for 4-bit textures)
+	// with bits 3 and 4 of the index swapped, csm2 a row of 16-bit colors
+	void load(const uint8_t* vram, const GsClutSource& source);
+};
+
+// textures decoded to linear ABGR8888 rows of 1 << tw texels
+class GsTextureCache {
+public:
+	// texels of key, decoded from vram unless a cached copy exists
+	// the pointer stays valid until the texture is invalidated or trimmed
+	const uint32_t* lookup(const uint8_t* vram, const GsClut& clut, const GsTextureKey& key);
+	// drops every texture that reads one of the pages
+	void invalidate(const GsPageSet& pages);
+	// evicts the least recently used textures past the size limit, only call it when nothing is queued
+	void trim();
+
+private:
+	struct Texture {
+		GsPageSet pages;
+		std::vector<uint32_t> texels;
+		uint64_t last_use;
+	};
+
+	std::unordered_map<GsTextureKey, Texture, GsTextureKeyHash> textures;
+	uint64_t clock {};
+	size_t texel_count {};
+};
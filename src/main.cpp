@@ -1,9 +1,19 @@
 #include "bus.hpp"
 #include "scheduler.hpp"
+#include "frame_mailbox.hpp"
 #include <SDL.h>
-#include <cassert>
+#include <string_view>
+#include <atomic>
+#include <thread>
+
+int main(int argc, char** argv) {
+	bool threaded_gs = false;
+	for (int i = 1; i < argc; ++i) {
+		if (std::string_view {argv[i]} == "--threaded-gs") {
+			threaded_gs = true;
+		}
+	}
 
-int main() {
 	SDL_Init(SDL_INIT_VIDEO);
 	SDL_SetHint(SDL_HINT_VIDEO_X11_NET_WM_BYPASS_COMPOSITOR, "0");
 	auto* window = SDL_CreateWindow(
@@ -16,83 +26,103 @@ int main() {
 	auto* renderer = SDL_CreateRenderer(window, 0, SDL_RENDERER_ACCELERATED);
 	auto* tex = SDL_CreateTexture(
 		renderer,
-		SDL_PIXELFORMAT_RGBA8888,
+		SDL_PIXELFORMAT_ABGR8888,
 		SDL_TEXTUREACCESS_STREAMING,
 		SCREEN_WIDTH,
 		SCREEN_HEIGHT
 		);
-	auto* backing = new uint32_t[SCREEN_HEIGHT * SCREEN_WIDTH];
+	// ABGR8888 is the byte order of gs colors, the output goes to the texture as is
+	// the picture is opaque, whatever alpha the frame buffer holds
+	SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
 
-	Bus bus {"../roms/bios.bin", backing};
-	bool running = true;
-	bool report = false;
+	Bus bus {"../roms/bios.bin"};
+	if (threaded_gs) {
+		bus.gs.start_thread();
+	}
+	std::atomic<bool> running = true;
+	// set by the presenter when enter is pressed, the emulation thread reports its next frame
+	std::atomic<bool> report_cpu = false;
+	bool report_render = false;
 	std::cerr << std::fixed;
 	std::cerr.precision(64);
 	auto freq = static_cast<double>(SDL_GetPerformanceFrequency());
+	FrameMailbox mailbox {SCREEN_WIDTH * SCREEN_HEIGHT};
 
-	while (running) {
-		auto frame_start = SDL_GetPerformanceCounter();
-		bool frame_ready = false;
-		bus.scheduler.schedule_event({
-			.cycles = EE_CYCLES_BETWEEN_NTSC_VBLANK,
-			.fn = [&]() {
-				// VBLANK start
-				bus.ee_cpu.raise_int0(2);
-				bus.gs.csr |= 1U << 3;
-				frame_ready = true;
+	// emulation runs on its own thread and moves on to the next frame as soon as one is read out at vblank,
+	// the main thread owns the window and shows whatever frame is newest when it gets to it
+	std::thread emulation {[&]() {
+		while (running.load(std::memory_order_relaxed)) {
+			auto frame_start = SDL_GetPerformanceCounter();
+			bool frame_ready = false;
+			bus.scheduler.schedule_event({
+				.cycles = EE_CYCLES_BETWEEN_NTSC_VBLANK,
+				.fn = [&]() {
+					// VBLANK start
+					bus.ee_cpu.raise_int0(2);
+					bus.gs.csr |= 1U << 3;
+					// FIELD flips every vblank, the pcrtc shows the lines of the new field
+					bus.gs.csr ^= 1U << 13;
+					frame_ready = true;
+				}
+			});
+			bus.scheduler.schedule_event({
+				.cycles = EE_CYCLES_BETWEEN_NTSC_VBLANK + EE_CYCLES_IN_NTSC_VBLANK,
+				.fn = [&]() {
+					// VBLANK end
+					bus.ee_cpu.raise_int0(3);
+					bus.gs.csr &= ~(1U << 3);
+				}
+			});
+			while (!frame_ready) {
+				bus.scheduler.run();
 			}
-		});
-		bus.scheduler.schedule_event({
-			.cycles = EE_CYCLES_BETWEEN_NTSC_VBLANK + EE_CYCLES_IN_NTSC_VBLANK,
-			.fn = [&]() {
-				// VBLANK end
-				bus.ee_cpu.raise_int0(3);
-				bus.gs.csr &= ~(1U << 3);
+
+			bus.gs.read_output(mailbox.back(), SCREEN_WIDTH * 4);
+			mailbox.publish();
+
+			auto cpu_frame_end = SDL_GetPerformanceCounter();
+			if (report_cpu.exchange(false, std::memory_order_relaxed)) {
+				auto cpu_time = static_cast<double>(cpu_frame_end - frame_start) / freq;
+				std::cerr << "cpu frame took " << cpu_time << "s\n";
 			}
-		});
-		while (!frame_ready) {
-			bus.scheduler.run();
 		}
-		auto cpu_frame_end = SDL_GetPerformanceCounter();
+	}};
 
+	while (running) {
 		SDL_Event event;
 		while (SDL_PollEvent(&event)) {
 			if (event.type == SDL_QUIT) {
 				running = false;
 			}
 			else if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_RETURN) {
-				report = true;
+				report_cpu = true;
+				report_render = true;
 			}
 		}
 
-		const auto& ctx = bus.gs.contexts[(bus.gs.prim & 1 << 9) ? 1 : 0];
-		assert(ctx.frame.fmt == 0);
-		auto fb_base_ptr = ctx.frame.base_ptr * 4 * 2048;
-		auto fb_width = ctx.frame.buf_width * 64;
-		auto* vram = bus.gs.vram.data() + fb_base_ptr;
-
-		for (uint16_t y = 0; y < SCREEN_HEIGHT; ++y) {
-			for (uint16_t x = 0; x < SCREEN_WIDTH; ++x) {
-				auto color = *(uint32_t*) &vram[y * fb_width * 4 + x * 4];
-				uint32_t real_color = (color & 0xFF) << 24 | (color >> 8 & 0xFF) << 16 | (color >> 16 & 0xFF) << 8 | (color >> 24 & 0xFF);
-				backing[y * SCREEN_WIDTH + x] = real_color;
-			}
+		const auto* frame = mailbox.take();
+		if (!frame) {
+			SDL_Delay(1);
+			continue;
 		}
-		SDL_UpdateTexture(tex, nullptr, backing, SCREEN_WIDTH * 4);
+
+		auto render_frame_start = SDL_GetPerformanceCounter();
+		// the renderer and its textures can only be used from the thread that made them, so the emulation thread
+		// reads its output into the mailbox and the frame is uploaded from it here, one copy to keep it presenting
+		// without waiting on emulation
+		SDL_UpdateTexture(tex, nullptr, frame, SCREEN_WIDTH * sizeof(uint32_t));
 		SDL_RenderCopy(renderer, tex, nullptr, nullptr);
 		SDL_RenderPresent(renderer);
 
 		auto render_frame_end = SDL_GetPerformanceCounter();
-		if (report) {
-			auto cpu_time = static_cast<double>(cpu_frame_end - frame_start) / freq;
-			auto render_time = static_cast<double>(render_frame_end - cpu_frame_end) / freq;
-			std::cerr << "cpu frame took " << cpu_time << "s\n";
+		if (report_render) {
+			auto render_time = static_cast<double>(render_frame_end - render_frame_start) / freq;
 			std::cerr << "render frame took " << render_time << "s\n";
-			report = false;
+			report_render = false;
 		}
 	}
+	emulation.join();
 
-	delete[] backing;
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// single producer single consumer ring, the capacity has to be a power of two
+template<typename T>
+class SpscRing {
+public:
+	explicit SpscRing(size_t capacity)
+		: storage {std::make_unique<T[]>(capacity)}, mask {capacity - 1} {}
+
+	void push(const T& value) {
+		auto write = head.load(std::memory_order_relaxed);
+		while (true) {
+			auto read = tail.load(std::memory_order_acquire);
+			if (write - read <= mask) {
+				break;
+			}
+			tail.wait(read, std::memory_order_acquire);
+		}
+
+		storage[write & mask] = value;
+		head.store(write + 1, std::memory_order_release);
+		head.notify_one();
+	}
+
+	bool pop(T& value) {
+		auto read = tail.load(std::memory_order_relaxed);
+		if (read == head.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		value = storage[read & mask];
+		tail.store(read + 1, std::memory_order_release);
+		tail.notify_one();
+		return true;
+	}
+
+	// blocks the consumer until there is something to pop
+	void wait_for_data() {
+		auto read = tail.load(std::memory_order_relaxed);
+		head.wait(read, std::memory_order_acquire);
+	}
+
+private:
+	std::unique_ptr<T[]> storage;
+	size_t mask;
+	alignas(64) std::atomic<size_t> head {};
+	alignas(64) std::atomic<size_t> tail {};
+};
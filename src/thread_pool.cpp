@@ -0,0 +1,81 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t workers) {
+	for (size_t i = 0; i < workers; ++i) {
+		threads.emplace_back([this]() {
+			worker_main();
+		});
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard guard {mutex};
+		quit = true;
+	}
+	start_cv.notify_all();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& fn) {
+	if (threads.empty() || count == 1) {
+		for (size_t i = 0; i < count; ++i) {
+			fn(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard guard {mutex};
+		job = &fn;
+		job_count = count;
+		next_job.store(0, std::memory_order_relaxed);
+		running = threads.size();
+		++generation;
+	}
+	start_cv.notify_all();
+
+	run_jobs();
+
+	std::unique_lock lock {mutex};
+	done_cv.wait(lock, [&]() {
+		return running == 0;
+	});
+	job = nullptr;
+}
+
+void ThreadPool::worker_main() {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock lock {mutex};
+			start_cv.wait(lock, [&]() {
+				return quit || generation != seen;
+			});
+			if (quit) {
+				return;
+			}
+			seen = generation;
+		}
+
+		run_jobs();
+
+		{
+			std::lock_guard guard {mutex};
+			--running;
+		}
+		done_cv.notify_one();
+	}
+}
+
+void ThreadPool::run_jobs() {
+	while (true) {
+		auto index = next_job.fetch_add(1, std::memory_order_relaxed);
+		if (index >= job_count) {
+			break;
+		}
+		(*job)(index);
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+	explicit ThreadPool(size_t workers);
+	~ThreadPool();
+
+	// runs fn for every index below count on the workers and the calling thread
+	void run(size_t count, const std::function<void(size_t)>& fn);
+
+private:
+	void worker_main();
+	void run_jobs();
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable start_cv;
+	std::condition_variable done_cv;
+	const std::function<void(size_t)>* job {};
+	size_t job_count {};
+	std::atomic<size_t> next_job {};
+	size_t running {};
+	uint64_t generation {};
+	bool quit {};
+};
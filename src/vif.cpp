@@ -0,0 +1,399 @@
+#include "vif.hpp"
+#include "bus.hpp"
+#include "vif_unpack.hpp"
+#include <cassert>
+#include <algorithm>
+
+#define VIF_CODE_IMM(code) ((code) & 0xFFFF)
+#define VIF_CODE_NUM(code) ((code) >> 16 & 0xFF)
+#define VIF_CODE_CMD(code) ((code) >> 24 & 0x7F)
+#define VIF_CODE_IBIT (1U << 31)
+
+#define VIF_CYCLE_CL(cycle) ((cycle) & 0xFF)
+#define VIF_CYCLE_WL(cycle) ((cycle) >> 8 & 0xFF)
+
+#define VIF_UNPACK_VL(cmd) ((cmd) & 0b11)
+#define VIF_UNPACK_VN(cmd) ((cmd) >> 2 & 0b11)
+#define VIF_UNPACK_ADDR(imm) ((imm) & 0x3FF)
+#define VIF_UNPACK_USN (1U << 14)
+#define VIF_UNPACK_FLG (1U << 15)
+
+#define VIF_STAT_VGW (1U << 3)
+#define VIF_STAT_MRK (1U << 6)
+#define VIF_STAT_DBF (1U << 7)
+#define VIF_STAT_VSS (1U << 8)
+#define VIF_STAT_VFS (1U << 9)
+#define VIF_STAT_VIS (1U << 10)
+#define VIF_STAT_INT (1U << 11)
+#define VIF_STAT_ER0 (1U << 12)
+#define VIF_STAT_ER1 (1U << 13)
+
+#define VIF_ERR_MII (1U << 0)
+
+#define VIF_CMD_DIRECT 0x50
+#define VIF_CMD_DIRECTHL 0x51
+
+namespace {
+	// a WL of 0 writes 256 vectors per cycle
+	uint32_t cycle_wl(uint32_t cycle) {
+		uint32_t wl = VIF_CYCLE_WL(cycle);
+		return wl ? wl : 256;
+	}
+}
+
+void Vif::reset() {
+	stat = 0;
+	cmd_remaining = 0;
+	cmd_data.clear();
+	held_words.clear();
+	num = 0;
+	mask = 0;
+	mode = 0;
+	cycle = 0;
+	dbf = false;
+	flush_gif = false;
+}
+
+void Vif::cancel_stall() {
+	stat &= ~(VIF_STAT_VSS | VIF_STAT_VFS | VIF_STAT_VIS | VIF_STAT_INT | VIF_STAT_ER0 | VIF_STAT_ER1);
+	resume();
+}
+
+uint32_t Vif::read(uint32_t addr) {
+	switch (addr & 0x3F0) {
+		case 0x000:
+			return stat | (dbf ? VIF_STAT_DBF : 0) | (cmd_remaining ? 0b11 : 0) | (waiting_for_gif() ? VIF_STAT_VGW : 0);
+		case 0x010:
+			return fbrst;
+		case 0x020:
+			return err;
+		case 0x030:
+			return mark;
+		case 0x040:
+			return cycle;
+		case 0x050:
+			return mode;
+		case 0x060:
+			return num;
+		case 0x070:
+			return mask;
+		case 0x080:
+			return code;
+		case 0x090:
+			return itops;
+		case 0x0A0:
+			return base;
+		case 0x0B0:
+			return ofst;
+		case 0x0C0:
+			return tops;
+		case 0x0D0:
+			return itop;
+		case 0x0E0:
+			return top;
+		case 0x100:
+		case 0x110:
+		case 0x120:
+		case 0x130:
+			return row[(addr >> 4) & 0b11];
+		case 0x140:
+		case 0x150:
+		case 0x160:
+		case 0x170:
+			return col[(addr >> 4) & 0b11];
+		default:
+			return 0;
+	}
+}
+
+void Vif::fifo_write32(uint32_t addr, uint32_t value) {
+	uint8_t index = addr >> 2 & 0b11;
+	fifo_words[index] = value;
+	if (index == 3) {
+		write_words(fifo_words);
+	}
+}
+
+size_t Vif::fifo_write(std::span<const Uint128> data) {
+	resume();
+	if (!held_words.empty()) {
+		return 0;
+	}
+
+	std::span words {reinterpret_cast<const uint32_t*>(data.data()), data.size() * 4};
+	size_t taken = process(words);
+	// the words after a stall inside a quadword already left the dma, they wait in the vif
+	size_t qwords = (taken + 3) / 4;
+	held_words.assign(words.begin() + taken, words.begin() + qwords * 4);
+	return qwords;
+}
+
+void Vif::write_tag(const Uint128& tag) {
+	write_words({reinterpret_cast<const uint32_t*>(&tag.high), 2});
+}
+
+bool Vif::waiting_for_gif() {
+	uint8_t cmd = VIF_CODE_CMD(code);
+	bool direct = cmd_remaining && (cmd == VIF_CMD_DIRECT || cmd == VIF_CMD_DIRECTHL);
+	if (!bus.gif.path_available(2)) {
+		return direct || flush_gif;
+	}
+	flush_gif = false;
+	return false;
+}
+
+bool Vif::stalled() {
+	return (stat & VIF_STAT_VIS) || waiting_for_gif();
+}
+
+void Vif::resume() {
+	if (!held_words.empty()) {
+		held_words.erase(held_words.begin(), held_words.begin() + process(held_words));
+	}
+}
+
+void Vif::write_words(std::span<const uint32_t> words) {
+	resume();
+	size_t taken = held_words.empty() ? process(words) : 0;
+	held_words.insert(held_words.end(), words.begin() + taken, words.end());
+}
+
+size_t Vif::process(std::span<const uint32_t> words) {
+	size_t size = words.size();
+	while (!words.empty()) {
+		if (stalled()) {
+			break;
+		}
+
+		if (!cmd_remaining) {
+			code = words[0];
+			words = words.subspan(1);
+			start_command();
+			continue;
+		}
+
+		// direct data is streamed to the gif as it arrives
+		uint8_t cmd = VIF_CODE_CMD(code);
+		if (cmd == VIF_CMD_DIRECT || cmd == VIF_CMD_DIRECTHL) {
+			auto count = std::min<size_t>(cmd_remaining, words.size());
+			assert(count % 4 == 0 && "misaligned direct data");
+			count = bus.gif.fifo_write({reinterpret_cast<const Uint128*>(words.data()), count / 4}, 2) * 4;
+			words = words.subspan(count);
+			cmd_remaining -= count;
+			if (!cmd_remaining && (code & VIF_CODE_IBIT)) {
+				raise_irq();
+			}
+			continue;
+		}
+
+		// the whole command is in this packet, run it straight from the packet
+		if (cmd_data.empty() && words.size() >= cmd_remaining) {
+			auto count = cmd_remaining;
+			cmd_remaining = 0;
+			run_command(words.first(count));
+			words = words.subspan(count);
+			continue;
+		}
+
+		auto count = std::min<size_t>(cmd_remaining, words.size());
+		cmd_data.insert(cmd_data.end(), words.begin(), words.begin() + count);
+		words = words.subspan(count);
+		cmd_remaining -= count;
+		if (!cmd_remaining) {
+			run_command(cmd_data);
+			cmd_data.clear();
+		}
+	}
+	return size - words.size();
+}
+
+void Vif::start_command() {
+	uint8_t cmd = VIF_CODE_CMD(code);
+	uint16_t imm = VIF_CODE_IMM(code);
+	uint32_t code_num = VIF_CODE_NUM(code);
+
+	// commands with data
+	if (cmd == 0x20) {
+		cmd_remaining = 1;
+	}
+	else if (cmd == 0x30 || cmd == 0x31) {
+		cmd_remaining = 4;
+	}
+	else if (cmd == 0x4A) {
+		cmd_remaining = (code_num ? code_num : 256) * 2;
+	}
+	else if (cmd == VIF_CMD_DIRECT || cmd == VIF_CMD_DIRECTHL) {
+		assert(id == 1 && "direct on vif0");
+		cmd_remaining = (imm ? imm : 0x10000) * 4;
+	}
+	else if ((cmd & 0x60) == 0x60) {
+		uint32_t cl = VIF_CYCLE_CL(cycle);
+		uint32_t wl = cycle_wl(cycle);
+		uint32_t vectors = code_num ? code_num : 256;
+		// with filling writes only cl out of every wl vectors come from the packet
+		if (wl > cl) {
+			vectors = vectors / wl * cl + std::min(vectors % wl, cl);
+		}
+
+		uint8_t vl = VIF_UNPACK_VL(cmd);
+		uint8_t vn = VIF_UNPACK_VN(cmd);
+		uint32_t bits = vl == 3 ? 16 : (32 >> vl) * (vn + 1);
+		num = code_num;
+		cmd_remaining = (vectors * bits + 31) / 32;
+	}
+
+	if (cmd_remaining) {
+		return;
+	}
+
+	run_command({});
+}
+
+void Vif::run_command(std::span<const uint32_t> data) {
+	uint8_t cmd = VIF_CODE_CMD(code);
+	uint16_t imm = VIF_CODE_IMM(code);
+
+	// NOP
+	if (cmd == 0x00) {
+
+	}
+	// STCYCL
+	else if (cmd == 0x01) {
+		cycle = imm;
+	}
+	// OFFSET
+	else if (cmd == 0x02) {
+		ofst = imm & 0x3FF;
+		dbf = false;
+		tops = base;
+	}
+	// BASE
+	else if (cmd == 0x03) {
+		base = imm & 0x3FF;
+	}
+	// ITOP
+	else if (cmd == 0x04) {
+		itops = imm & 0x3FF;
+	}
+	// STMOD
+	else if (cmd == 0x05) {
+		mode = imm & 0b11;
+	}
+	// MSKPATH3
+	else if (cmd == 0x06) {
+		bus.gif.path3_masked = imm & 1U << 15;
+		// the gif channel skipped while PATH3 was masked can run again
+		if (!bus.gif.path3_masked) {
+			bus.dmac.kick();
+		}
+	}
+	// MARK
+	else if (cmd == 0x07) {
+		mark = imm;
+		stat |= VIF_STAT_MRK;
+	}
+	// FLUSHE, FLUSH
+	else if (cmd == 0x10 || cmd == 0x11) {
+		// vu microprograms aren't run and PATH2 is this vif's own, there is never anything to wait for
+	}
+	// FLUSHA
+	else if (cmd == 0x13) {
+		// the next command waits until PATH3 is done with the packet it is in
+		flush_gif = true;
+	}
+	// MSCAL, MSCALF, MSCNT
+	else if (cmd == 0x14 || cmd == 0x15 || cmd == 0x17) {
+		// vu microprograms aren't run, starting one only latches the registers the vu would read
+		itop = itops;
+		if (id == 1) {
+			top = tops;
+			dbf = !dbf;
+			tops = dbf ? base + ofst : base;
+		}
+	}
+	// STMASK
+	else if (cmd == 0x20) {
+		mask = data[0];
+	}
+	// STROW
+	else if (cmd == 0x30) {
+		std::copy_n(data.begin(), 4, row);
+	}
+	// STCOL
+	else if (cmd == 0x31) {
+		std::copy_n(data.begin(), 4, col);
+	}
+	// MPG
+	else if (cmd == 0x4A) {
+		write_mpg(data);
+	}
+	// UNPACK
+	else if ((cmd & 0x60) == 0x60) {
+		unpack(data);
+	}
+	else {
+		std::cerr << "unimplemented vifcode " << std::hex << std::uppercase
+		          << static_cast<int>(cmd) << std::dec << '\n';
+		abort();
+	}
+
+	if (code & VIF_CODE_IBIT) {
+		raise_irq();
+	}
+}
+
+void Vif::write_mpg(std::span<const uint32_t> data) {
+	auto code_mem = vu_code();
+	uint32_t offset = VIF_CODE_IMM(code) * 8;
+	for (size_t i = 0; i < data.size(); i += 2) {
+		offset &= code_mem.size() - 1;
+		std::copy_n(reinterpret_cast<const uint8_t*>(data.data() + i), 8, code_mem.data() + offset);
+		offset += 8;
+	}
+}
+
+void Vif::unpack(std::span<const uint32_t> data) {
+	uint8_t cmd = VIF_CODE_CMD(code);
+	uint16_t imm = VIF_CODE_IMM(code);
+
+	uint32_t addr = VIF_UNPACK_ADDR(imm);
+	if (id == 1 && (imm & VIF_UNPACK_FLG)) {
+		addr += tops;
+	}
+
+	uint32_t cl = VIF_CYCLE_CL(cycle);
+	uint32_t wl = cycle_wl(cycle);
+
+	auto mem = vu_data();
+	VifUnpackState state {
+		.src = reinterpret_cast<const uint8_t*>(data.data()),
+		.mem = mem.data(),
+		.addr = addr,
+		.addr_mask = static_cast<uint32_t>(mem.size() / 16 - 1),
+		.vectors = num ? num : 256,
+		.cl = cl,
+		.wl = wl,
+		.mask = mask,
+		.row = row,
+		.col = col
+	};
+	auto kernel = get_vif_unpack_kernel(cmd, imm & VIF_UNPACK_USN, mode, wl > cl);
+	kernel(state);
+}
+
+void Vif::raise_irq() {
+	if (err & VIF_ERR_MII) {
+		return;
+	}
+	// the vif stops after the command until FBRST.STC
+	stat |= VIF_STAT_INT | VIF_STAT_VIS;
+	bus.ee_cpu.raise_int0(id == 0 ? 4 : 5);
+}
+
+std::span<uint8_t> Vif::vu_code() {
+	return id == 0 ? bus.vu0_code : bus.vu1_code;
+}
+
+std::span<uint8_t> Vif::vu_data() {
+	return id == 0 ? bus.vu0_data : bus.vu1_data;
+}
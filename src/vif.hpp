@@ -1,12 +1,72 @@
 #pragma once
 #include <cstdint>
+#include <span>
+#include <vector>
+#include "utils.hpp"
 
 struct Bus;
 
 struct Vif {
 	Bus& bus;
+	uint8_t id;
 	uint32_t stat;
 	uint32_t fbrst;
 	uint32_t err;
 	uint32_t mark;
+
+	uint32_t cycle;
+	uint32_t mode;
+	uint32_t num;
+	uint32_t mask;
+	uint32_t code;
+	uint32_t itops;
+	uint32_t base;
+	uint32_t ofst;
+	uint32_t tops;
+	uint32_t itop;
+	uint32_t top;
+	uint32_t row[4];
+	uint32_t col[4];
+	bool dbf;
+	// FLUSHA is waiting for PATH3 to end its packet
+	bool flush_gif;
+
+	// fifo writes from the ee are gathered into a quadword
+	uint32_t fifo_words[4];
+
+	// words of data still expected by the current command, 0 when waiting for a vifcode
+	uint32_t cmd_remaining;
+	// data of a command that straddles two packets
+	std::vector<uint32_t> cmd_data;
+	// the rest of a quadword the vif stalled inside of, run before anything that comes after it
+	std::vector<uint32_t> held_words;
+
+	void reset();
+	// FBRST.STC, the vif goes on after a stall
+	void cancel_stall();
+	uint32_t read(uint32_t addr);
+	void fifo_write32(uint32_t addr, uint32_t value);
+	// returns the quadwords taken, a quadword the vif stalls inside of counts as taken
+	size_t fifo_write(std::span<const Uint128> data);
+	// the upper half of a dma tag transferred with TTE
+	void write_tag(const Uint128& tag);
+	// the vif takes no data while set
+	bool stalled();
+	// runs the held words once the stall that held them has ended
+	void resume();
+
+private:
+	// direct data and FLUSHA wait while another path is in the middle of a gif packet
+	bool waiting_for_gif();
+	// words that can't be refused, what a stall leaves of them is held
+	void write_words(std::span<const uint32_t> words);
+	// returns the words run before the vif stalled
+	size_t process(std::span<const uint32_t> words);
+	void start_command();
+	void run_command(std::span<const uint32_t> data);
+	void unpack(std::span<const uint32_t> data);
+	void write_mpg(std::span<const uint32_t> data);
+	void raise_irq();
+	std::span<uint8_t> vu_code();
+	std::span<uint8_t> vu_data();
 };
@@ -0,0 +1,199 @@
+#include "vif_unpack.hpp"
+#include "utils.hpp"
+#include <immintrin.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+namespace {
+	enum class UnpackMode {
+		Normal,
+		Offset,
+		Difference
+	};
+
+	template<int Bytes>
+	inline __m128i load_bytes(const uint8_t* src) {
+		if constexpr (Bytes == 16) {
+			return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+		}
+		else if constexpr (Bytes == 12) {
+			uint32_t last;
+			std::memcpy(&last, src + 8, 4);
+			return _mm_insert_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)), static_cast<int>(last), 2);
+		}
+		else {
+			uint64_t value = 0;
+			std::memcpy(&value, src, Bytes);
+			return _mm_cvtsi64_si128(static_cast<long long>(value));
+		}
+	}
+
+	// reads one input vector and expands it to four 32-bit fields
+	template<int Vn, int Vl, bool Unsigned>
+	inline __m128i load_vector(const uint8_t* src) {
+		if constexpr (Vl == 3) {
+			uint16_t value;
+			std::memcpy(&value, src, 2);
+			auto v = _mm_set1_epi32(value);
+#ifdef __AVX2__
+			v = _mm_srlv_epi32(v, _mm_setr_epi32(0, 5, 10, 15));
+			v = _mm_and_si128(v, _mm_setr_epi32(0x1F, 0x1F, 0x1F, 1));
+			return _mm_sllv_epi32(v, _mm_setr_epi32(3, 3, 3, 7));
+#else
+			return _mm_setr_epi32(
+				(value & 0x1F) << 3,
+				(value >> 5 & 0x1F) << 3,
+				(value >> 10 & 0x1F) << 3,
+				(value >> 15) << 7);
+#endif
+		}
+		else {
+			constexpr int comp_bytes = 4 >> Vl;
+			auto v = load_bytes<comp_bytes * (Vn + 1)>(src);
+			if constexpr (Vl == 1) {
+				v = Unsigned ? _mm_cvtepu16_epi32(v) : _mm_cvtepi16_epi32(v);
+			}
+			else if constexpr (Vl == 2) {
+				v = Unsigned ? _mm_cvtepu8_epi32(v) : _mm_cvtepi8_epi32(v);
+			}
+
+			if constexpr (Vn == 0) {
+				v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0));
+			}
+			else if constexpr (Vn == 1) {
+				v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 1, 0));
+			}
+			// v3 leaves w zeroed by the partial load
+			return v;
+		}
+	}
+
+	template<int Vn, int Vl>
+	constexpr uint32_t input_bytes() {
+		return Vl == 3 ? 2 : (4 >> Vl) * (Vn + 1);
+	}
+
+	template<int Vn, int Vl, bool Unsigned, bool Masked, UnpackMode Mode, bool Filling>
+	void unpack_kernel(VifUnpackState& state) {
+		const uint8_t* src = state.src;
+		auto row = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.row));
+
+		// per write cycle lane selects: data, row, column and write protected
+		__m128i data_sel[4];
+		__m128i row_sel[4];
+		__m128i col_value[4];
+		__m128i keep_sel[4];
+		for (int cyc = 0; cyc < 4; ++cyc) {
+			uint32_t sels[4];
+			for (int c = 0; c < 4; ++c) {
+				sels[c] = Masked ? state.mask >> (cyc * 8 + c * 2) & 0b11 : 0;
+			}
+			auto lanes = _mm_setr_epi32(
+				static_cast<int>(sels[0]), static_cast<int>(sels[1]),
+				static_cast<int>(sels[2]), static_cast<int>(sels[3]));
+			data_sel[cyc] = _mm_cmpeq_epi32(lanes, _mm_setzero_si128());
+			row_sel[cyc] = _mm_cmpeq_epi32(lanes, _mm_set1_epi32(1));
+			col_value[cyc] = _mm_and_si128(
+				_mm_set1_epi32(static_cast<int>(state.col[cyc])),
+				_mm_cmpeq_epi32(lanes, _mm_set1_epi32(2)));
+			keep_sel[cyc] = _mm_cmpeq_epi32(lanes, _mm_set1_epi32(3));
+		}
+
+		uint32_t dest = state.addr;
+		uint32_t block_pos = 0;
+		for (uint32_t i = 0; i < state.vectors; ++i) {
+			uint32_t cyc = std::min(block_pos, 3U);
+
+			__m128i v;
+			if (!Filling || block_pos < state.cl) {
+				v = load_vector<Vn, Vl, Unsigned>(src);
+				src += input_bytes<Vn, Vl>();
+			}
+			else {
+				v = _mm_setzero_si128();
+			}
+
+			if constexpr (Mode == UnpackMode::Offset) {
+				v = _mm_add_epi32(v, row);
+			}
+			else if constexpr (Mode == UnpackMode::Difference) {
+				if constexpr (Masked) {
+					row = _mm_add_epi32(row, _mm_and_si128(v, data_sel[cyc]));
+				}
+				else {
+					row = _mm_add_epi32(row, v);
+				}
+				v = row;
+			}
+
+			auto* out = reinterpret_cast<__m128i*>(state.mem + (dest & state.addr_mask) * 16);
+			if constexpr (Masked) {
+				v = _mm_and_si128(v, data_sel[cyc]);
+				v = _mm_or_si128(v, _mm_and_si128(row, row_sel[cyc]));
+				v = _mm_or_si128(v, col_value[cyc]);
+				v = _mm_blendv_epi8(v, _mm_loadu_si128(out), keep_sel[cyc]);
+			}
+			_mm_storeu_si128(out, v);
+
+			++dest;
+			if (++block_pos == state.wl) {
+				block_pos = 0;
+				if constexpr (!Filling) {
+					dest += state.cl - state.wl;
+				}
+			}
+		}
+
+		state.src = src;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state.row), row);
+	}
+
+	void unpack_invalid(VifUnpackState&) {
+		UNREACHABLE("invalid vif unpack format");
+	}
+
+	// table index: cmd format bits, unsigned, masked, mode, filling
+	constexpr size_t KERNEL_COUNT = 16 * 2 * 2 * 3 * 2;
+
+	template<size_t Index>
+	constexpr VifUnpackKernel make_kernel() {
+		constexpr bool filling = Index % 2;
+		constexpr auto mode = static_cast<UnpackMode>(Index / 2 % 3);
+		constexpr bool masked = Index / 6 % 2;
+		constexpr bool is_unsigned = Index / 12 % 2;
+		constexpr int vl = Index / 24 & 0b11;
+		constexpr int vn = Index / 24 >> 2 & 0b11;
+		if constexpr (vl == 3 && vn != 3) {
+			return unpack_invalid;
+		}
+		// signedness only matters for 8 and 16-bit fields
+		else if constexpr (is_unsigned && (vl == 0 || vl == 3)) {
+			return make_kernel<Index - 12>();
+		}
+		else {
+			return unpack_kernel<vn, vl, is_unsigned, masked, mode, filling>;
+		}
+	}
+
+	template<size_t... I>
+	constexpr std::array<VifUnpackKernel, KERNEL_COUNT> make_kernel_table(std::index_sequence<I...>) {
+		return {make_kernel<I>()...};
+	}
+
+	constexpr auto KERNELS = make_kernel_table(std::make_index_sequence<KERNEL_COUNT> {});
+}
+
+VifUnpackKernel get_vif_unpack_kernel(uint8_t cmd, bool is_unsigned, uint8_t mode, bool filling) {
+	// mode 3 is undefined and behaves like normal mode
+	if (mode == 3) {
+		mode = 0;
+	}
+	size_t index = cmd & 0xF;
+	index = index * 2 + is_unsigned;
+	index = index * 2 + (cmd >> 4 & 1);
+	index = index * 3 + mode;
+	index = index * 2 + filling;
+	return KERNELS[index];
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+struct VifUnpackState {
+	const uint8_t* src;
+	uint8_t* mem;
+	// destination quadword and the mask wrapping it to the vu memory
+	uint32_t addr;
+	uint32_t addr_mask;
+	uint32_t vectors;
+	uint32_t cl;
+	uint32_t wl;
+	uint32_t mask;
+	// updated in difference mode
+	uint32_t* row;
+	const uint32_t* col;
+};
+
+using VifUnpackKernel = void (*)(VifUnpackState& state);
+
+VifUnpackKernel get_vif_unpack_kernel(uint8_t cmd, bool is_unsigned, uint8_t mode, bool filling);
@@ -0,0 +1,88 @@
+// nanoseconds per 8-pixel span of the color stage, jitted and generic, for a few common draw states
+#include "gs.hpp"
+#include "gs_pixel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+	constexpr size_t SPANS = 1024;
+	constexpr int PASSES = 200;
+
+	// the blend selectors of (A - B) * C + D
+	constexpr uint32_t blend(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+		return GS_COLOR_ABE | a << 2 | b << 4 | c << 6 | d << 8;
+	}
+
+	struct State {
+		const char* name;
+		uint32_t key;
+	};
+
+	constexpr State STATES[] = {
+		{"plain", 0},
+		{"fog", GS_COLOR_FGE},
+		{"alpha", blend(0, 1, 0, 1)},
+		{"alpha fog dither", blend(0, 1, 2, 1) | GS_COLOR_FGE | GS_COLOR_DTHE},
+		{"additive clamp", blend(0, 2, 0, 1) | GS_COLOR_COLCLAMP},
+		{"pabe fba", blend(0, 1, 0, 1) | GS_COLOR_PABE | GS_COLOR_FBA}
+	};
+
+	// the best of a few runs over every span PASSES times
+	double measure(Gs::ColorKernel kernel, const std::vector<Gs::Span8>& spans, std::vector<Gs::ColorArgs>& args) {
+		double best = 1e9;
+		for (int run = 0; run < 5; ++run) {
+			auto start = std::chrono::steady_clock::now();
+			for (int pass = 0; pass < PASSES; ++pass) {
+				for (size_t i = 0; i < SPANS; ++i) {
+					kernel(&spans[i], &args[i]);
+				}
+			}
+			std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+			best = std::min(best, time.count() / (PASSES * SPANS));
+		}
+		return best;
+	}
+}
+
+int main() {
+	GsJit jit;
+	if (!jit.available()) {
+		std::printf("the host can't run jitted kernels\n");
+		return 0;
+	}
+
+	std::mt19937 rng {1};
+	std::vector<Gs::Span8> spans(SPANS);
+	std::vector<Gs::ColorArgs> args(SPANS);
+	for (size_t i = 0; i < SPANS; ++i) {
+		for (int lane = 0; lane < 8; ++lane) {
+			spans[i].r[lane] = rng() & 0xFF;
+			spans[i].g[lane] = rng() & 0xFF;
+			spans[i].b[lane] = rng() & 0xFF;
+			spans[i].a[lane] = rng() & 0xFF;
+			spans[i].fog[lane] = rng() & 0xFF;
+			args[i].dest[lane] = static_cast<uint32_t>(rng());
+			args[i].dither[lane] = static_cast<int32_t>(rng() % 8) - 4;
+		}
+		args[i].fog_color = static_cast<uint32_t>(rng()) & 0xFFFFFF;
+		args[i].fix = 0x40;
+	}
+
+	std::printf("%-18s %10s %10s\n", "state", "generic", "jit");
+	for (const auto& state : STATES) {
+		for (auto& arg : args) {
+			arg.key = state.key;
+		}
+		const void* code;
+		while (!(code = jit.get(state.key))) {
+			std::this_thread::yield();
+		}
+		double generic = measure(gs_color_generic, spans, args);
+		double jitted = measure(reinterpret_cast<Gs::ColorKernel>(code), spans, args);
+		std::printf("%-18s %8.2fns %8.2fns\n", state.name, generic, jitted);
+	}
+}
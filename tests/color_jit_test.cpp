@@ -0,0 +1,73 @@
+// every color kernel the jit compiles computes the same colors as gs_color_generic
+#include "gs.hpp"
+#include "gs_pixel.hpp"
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace {
+	// spans per key, enough for every clamp and wrap the blend selectors can hit
+	constexpr int SPANS = 64;
+
+	// the reserved blend selectors are folded into the others before the key is made
+	bool valid_key(uint32_t key) {
+		return GS_COLOR_BLEND_A(key) != 3 && GS_COLOR_BLEND_B(key) != 3 &&
+			GS_COLOR_BLEND_C(key) != 3 && GS_COLOR_BLEND_D(key) != 3;
+	}
+}
+
+int main() {
+	GsJit jit;
+	if (!jit.available()) {
+		std::cerr << "color_jit_test: the host can't run jitted kernels, skipped\n";
+		return 0;
+	}
+
+	std::mt19937 rng {1};
+	auto byte = [&]() {
+		return static_cast<uint32_t>(rng() & 0xFF);
+	};
+	uint32_t keys = 0;
+	uint32_t bad = 0;
+	for (uint32_t key = 0; key < GS_COLOR_FBA << 1; ++key) {
+		if (!valid_key(key)) {
+			continue;
+		}
+		const void* code;
+		while (!(code = jit.get(key))) {
+			std::this_thread::yield();
+		}
+		auto kernel = reinterpret_cast<Gs::ColorKernel>(code);
+		++keys;
+
+		for (int i = 0; i < SPANS; ++i) {
+			Gs::Span8 span {};
+			Gs::ColorArgs jitted {};
+			for (int lane = 0; lane < 8; ++lane) {
+				span.r[lane] = byte();
+				span.g[lane] = byte();
+				span.b[lane] = byte();
+				span.a[lane] = byte();
+				span.fog[lane] = byte();
+				jitted.dest[lane] = static_cast<uint32_t>(rng());
+				jitted.dither[lane] = static_cast<int32_t>(rng() % 8) - 4;
+			}
+			jitted.fog_color = static_cast<uint32_t>(rng()) & 0xFFFFFF;
+			jitted.fix = byte();
+			jitted.key = key;
+			auto generic = jitted;
+			kernel(&span, &jitted);
+			gs_color_generic(&span, &generic);
+			if (!std::equal(jitted.out, jitted.out + 8, generic.out)) {
+				if (bad++ < 8) {
+					std::cerr << "color_jit_test: key 0x" << std::hex << key << std::dec << " differs from the generic path\n";
+				}
+				break;
+			}
+		}
+	}
+
+	std::cerr << "color_jit_test: " << keys << " keys, " << bad << " differ\n";
+	return bad ? 1 : 0;
+}
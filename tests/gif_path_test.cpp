@@ -0,0 +1,133 @@
+// the gif only lets a path start a packet between the packets of the others, and MSKPATH3 holds PATH3 back
+#include "bus.hpp"
+#include <iostream>
+#include <memory>
+
+namespace {
+	constexpr uint32_t PATH3_ADDR = 0x10000;
+	constexpr uint32_t PATH2_ADDR = 0x20000;
+	// more than one dma slice so the vif1 transfer starts in the middle of it
+	constexpr uint32_t PATH3_NLOOP = 100;
+
+	constexpr uint32_t CHCR_FROM_MEM = 1U << 0;
+	constexpr uint32_t CHCR_STR = 1U << 8;
+	constexpr uint32_t VIF1_CHANNEL = 0x10009000;
+	constexpr uint32_t GIF_CHANNEL = 0x1000A000;
+	// MSKPATH3 with the mask bit clear, the vifcode in the last word of a quadword
+	constexpr uint32_t MSKPATH3 = 0x06U << 24;
+	constexpr uint32_t MSKPATH3_MASK = 1U << 15;
+
+	// a PACKED tag of A+D writes
+	Uint128 ad_tag(uint32_t nloop) {
+		return {nloop | 1ULL << 15 | 1ULL << 60, 0xE};
+	}
+
+	void write_qword(Bus& bus, uint32_t addr, Uint128 value) {
+		bus.write64(addr, value.low);
+		bus.write64(addr + 8, value.high);
+	}
+
+	bool check(bool ok, const char* what) {
+		if (!ok) {
+			std::cerr << "gif_path_test: " << what << '\n';
+		}
+		return ok;
+	}
+
+	// starts a channel on a normal mode transfer of qwc quadwords at addr
+	void start_channel(Bus& bus, uint32_t base, uint32_t addr, uint32_t qwc) {
+		bus.dmac.write(base + 0x10, addr);
+		bus.dmac.write(base + 0x20, qwc);
+		bus.dmac.write(base, CHCR_STR | CHCR_FROM_MEM);
+	}
+
+	bool running(Bus& bus, int channel) {
+		return bus.dmac.channels[channel].chcr & CHCR_STR;
+	}
+
+	void run_until_vif1_done(Bus& bus) {
+		for (int i = 0; i < 1000 && running(bus, 1); ++i) {
+			bus.scheduler.run();
+		}
+		// a few more slices for whatever the gif was held up on
+		for (int i = 0; i < 100; ++i) {
+			bus.scheduler.run();
+		}
+	}
+
+	// PATH3 sets FOGCOL over and over and TEXA last
+	void write_path3_packet(Bus& bus, uint32_t addr) {
+		write_qword(bus, addr, ad_tag(PATH3_NLOOP));
+		for (uint32_t i = 0; i < PATH3_NLOOP - 1; ++i) {
+			write_qword(bus, addr + 16 + i * 16, {i, 0x3D});
+		}
+		write_qword(bus, addr + PATH3_NLOOP * 16, {0x40ULL << 32 | 0x80, 0x3B});
+	}
+
+	// a vif1 DIRECT packet sent while a PATH3 packet is half way through the gif waits for it to end
+	bool direct_waits_for_path3() {
+		auto bus = std::make_unique<Bus>("");
+		write_path3_packet(*bus, PATH3_ADDR);
+
+		// PATH2 sets FOGCOL once, it has to come after all of PATH3
+		write_qword(*bus, PATH2_ADDR, {0, 0x50000003ULL << 32});
+		write_qword(*bus, PATH2_ADDR + 16, ad_tag(2));
+		write_qword(*bus, PATH2_ADDR + 32, {0x111111, 0x3D});
+		write_qword(*bus, PATH2_ADDR + 48, {0x123456, 0x3D});
+
+		bus->dmac.ctrl = 1;
+		start_channel(*bus, GIF_CHANNEL, PATH3_ADDR, PATH3_NLOOP + 1);
+		// the first gif slice runs right away
+		bus->scheduler.run();
+
+		bool ok = check(bus->gif.active_path == 3, "the first slice didn't leave PATH3 in the middle of its packet");
+
+		start_channel(*bus, VIF1_CHANNEL, PATH2_ADDR, 4);
+		for (int i = 0; i < 1000 && (running(*bus, 1) || running(*bus, 2)); ++i) {
+			bus->scheduler.run();
+		}
+
+		ok &= check(!running(*bus, 1), "vif1 dma didn't finish");
+		ok &= check(!running(*bus, 2), "gif dma didn't finish");
+		ok &= check(bus->gif.active_path == 0, "the gif didn't go idle");
+		ok &= check(bus->gs.texa.ta0 == 0x80 && bus->gs.texa.ta1 == 0x40, "PATH3 lost its last write");
+		ok &= check(bus->gs.fog_color == 0x123456, "PATH2 didn't write after PATH3");
+		return ok;
+	}
+
+	// MSKPATH3 set while a PATH3 packet is half way through lets it end and holds up the next one until it's cleared
+	bool mskpath3_holds_the_next_packet() {
+		auto bus = std::make_unique<Bus>("");
+		write_path3_packet(*bus, PATH3_ADDR);
+		// a second packet after it sets FOGCOL
+		write_qword(*bus, PATH3_ADDR + (PATH3_NLOOP + 1) * 16, ad_tag(1));
+		write_qword(*bus, PATH3_ADDR + (PATH3_NLOOP + 2) * 16, {0xABCDEF, 0x3D});
+
+		write_qword(*bus, PATH2_ADDR, {0, static_cast<uint64_t>(MSKPATH3 | MSKPATH3_MASK) << 32});
+		write_qword(*bus, PATH2_ADDR + 16, {0, static_cast<uint64_t>(MSKPATH3) << 32});
+
+		bus->dmac.ctrl = 1;
+		start_channel(*bus, GIF_CHANNEL, PATH3_ADDR, PATH3_NLOOP + 3);
+		bus->scheduler.run();
+		bool ok = check(bus->gif.active_path == 3, "the first slice didn't leave PATH3 in the middle of its packet");
+
+		start_channel(*bus, VIF1_CHANNEL, PATH2_ADDR, 1);
+		run_until_vif1_done(*bus);
+		ok &= check(bus->gs.texa.ta0 == 0x80 && bus->gs.texa.ta1 == 0x40, "masking PATH3 cut its packet short");
+		ok &= check(running(*bus, 2), "the gif dma finished with PATH3 masked");
+		ok &= check(bus->gs.fog_color == PATH3_NLOOP - 2, "PATH3 started a packet while it was masked");
+		ok &= check(bus->read32(0x10003020) & 1U << 1, "GIF_STAT doesn't show PATH3 masked");
+
+		start_channel(*bus, VIF1_CHANNEL, PATH2_ADDR + 16, 1);
+		run_until_vif1_done(*bus);
+		ok &= check(!running(*bus, 2), "the gif dma didn't finish once PATH3 was unmasked");
+		ok &= check(bus->gs.fog_color == 0xABCDEF, "PATH3 didn't send its next packet once unmasked");
+		return ok;
+	}
+}
+
+int main() {
+	bool ok = direct_waits_for_path3();
+	ok &= mskpath3_holds_the_next_packet();
+	return ok ? 0 : 1;
+}
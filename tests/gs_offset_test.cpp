@@ -0,0 +1,101 @@
+// prims with vertices left of and above the drawing offset only draw the part of them right of and below it
+#include "bus.hpp"
+#include "gs_format.hpp"
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+	constexpr uint32_t WIDTH = 640;
+	constexpr uint32_t HEIGHT = 448;
+	constexpr int OFFSET = 2048;
+
+	constexpr uint32_t TRIANGLE = 0xFF0000FF;
+	constexpr uint32_t SPRITE = 0xFF00FF00;
+	constexpr uint32_t LINE = 0xFFFF0000;
+	constexpr uint32_t POINT = 0xFFFFFFFF;
+
+	// XYZ2 of a vertex at whole pixels relative to the offset
+	uint64_t xyz(int x, int y) {
+		auto gx = static_cast<uint64_t>((OFFSET + x) * 16);
+		auto gy = static_cast<uint64_t>((OFFSET + y) * 16);
+		return gx | gy << 16;
+	}
+
+	void draw(Gs& gs, uint8_t type, uint32_t color, std::initializer_list<std::pair<int, int>> vertices) {
+		gs.submit(0x00, type);
+		// RGBAQ has r, g, b, a from the low byte up like a CT32 pixel
+		gs.submit(0x01, color);
+		for (auto [x, y] : vertices) {
+			gs.submit(0x05, xyz(x, y));
+		}
+	}
+
+	bool check(bool ok, const char* what) {
+		if (!ok) {
+			std::cerr << "gs_offset_test: " << what << '\n';
+		}
+		return ok;
+	}
+}
+
+int main() {
+	auto bus = std::make_unique<Bus>("");
+	auto& gs = bus->gs;
+	std::fill(gs.vram.begin(), gs.vram.end(), 0);
+
+	// a 640 wide CT32 frame at 0, z written to a buffer of its own with the test always passing
+	gs.submit(0x4C, 0 | (WIDTH / 64) << 16);
+	gs.submit(0x4E, 0x100);
+	gs.submit(0x47, 1 << 16 | 1 << 17);
+	gs.submit(0x40, (WIDTH - 1ULL) << 16 | (HEIGHT - 1ULL) << 48);
+	gs.submit(0x18, static_cast<uint64_t>(OFFSET * 16) | static_cast<uint64_t>(OFFSET * 16) << 32);
+
+	draw(gs, 3, TRIANGLE, {{-10, 10}, {20, 10}, {5, 40}});
+	draw(gs, 6, SPRITE, {{-10, 50}, {20, 60}});
+	draw(gs, 1, LINE, {{-10, 80}, {10, 80}});
+	draw(gs, 0, POINT, {{-1, 70}});
+	draw(gs, 0, POINT, {{3, 70}});
+	gs.sync();
+
+	uint32_t triangle = 0;
+	uint32_t sprite = 0;
+	uint32_t line = 0;
+	uint32_t point = 0;
+	// pixels written outside the prim that has their color
+	uint32_t stray = 0;
+	std::vector<uint32_t> row(WIDTH);
+	for (uint32_t y = 0; y < HEIGHT; ++y) {
+		gs_read_span(gs.vram.data(), GS_PSMCT32, 0, WIDTH / 64, 0, y, WIDTH, row.data());
+		for (uint32_t x = 0; x < WIDTH; ++x) {
+			uint32_t color = row[x];
+			if (color == TRIANGLE) {
+				++triangle;
+				stray += !(x < 20 && y >= 10 && y <= 40);
+			}
+			else if (color == SPRITE) {
+				++sprite;
+				stray += !(x < 20 && y >= 50 && y < 60);
+			}
+			else if (color == LINE) {
+				++line;
+				stray += !(x < 10 && y == 80);
+			}
+			else if (color == POINT) {
+				++point;
+				stray += !(x == 3 && y == 70);
+			}
+			else {
+				stray += color != 0;
+			}
+		}
+	}
+
+	bool ok = check(stray == 0, "pixels were drawn outside the prims");
+	// the triangle covers 350 pixels right of the offset, give or take the ones its edges cross
+	ok &= check(triangle >= 300 && triangle <= 400, "the triangle drew the wrong number of pixels");
+	ok &= check(sprite == 20 * 10, "the sprite drew the wrong number of pixels");
+	ok &= check(line == 10, "the line drew the wrong number of pixels");
+	ok &= check(point == 1, "the points drew the wrong number of pixels");
+	return ok ? 0 : 1;
+}
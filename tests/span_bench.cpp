@@ -0,0 +1,75 @@
+// pixels per second gs_read_span and gs_write_span move for every pixel storage format,
+// a 640 pixel row at a time over a 640x448 buffer
+#include "gs_format.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+	constexpr uint32_t WIDTH = 640;
+	constexpr uint32_t HEIGHT = 448;
+	constexpr int PASSES = 20;
+
+	struct Format {
+		const char* name;
+		uint8_t psm;
+	};
+
+	constexpr Format FORMATS[] = {
+		{"CT32", GS_PSMCT32},
+		{"CT24", GS_PSMCT24},
+		{"CT16", GS_PSMCT16},
+		{"CT16S", GS_PSMCT16S},
+		{"T8", GS_PSMT8},
+		{"T4", GS_PSMT4},
+		{"T8H", GS_PSMT8H},
+		{"T4HL", GS_PSMT4HL},
+		{"T4HH", GS_PSMT4HH},
+		{"Z32", GS_PSMZ32},
+		{"Z24", GS_PSMZ24},
+		{"Z16", GS_PSMZ16},
+		{"Z16S", GS_PSMZ16S}
+	};
+
+	// the best of a few runs of every row of the buffer PASSES times, in megapixels per second
+	template<typename F>
+	double measure(F&& span) {
+		double best = 0;
+		for (int run = 0; run < 3; ++run) {
+			auto start = std::chrono::steady_clock::now();
+			for (int pass = 0; pass < PASSES; ++pass) {
+				for (uint32_t y = 0; y < HEIGHT; ++y) {
+					span(y);
+				}
+			}
+			std::chrono::duration<double, std::micro> time = std::chrono::steady_clock::now() - start;
+			best = std::max(best, WIDTH * HEIGHT * PASSES / time.count());
+		}
+		return best;
+	}
+}
+
+int main() {
+	std::vector<uint8_t> vram(GS_VRAM_SIZE);
+	std::mt19937 rng {1};
+	std::generate(vram.begin(), vram.end(), [&] { return static_cast<uint8_t>(rng()); });
+	std::vector<uint32_t> row(WIDTH);
+	std::generate(row.begin(), row.end(), [&] { return static_cast<uint32_t>(rng()); });
+
+	// checksum of what was read so the reads can't be optimized out
+	uint32_t sum = 0;
+	std::printf("%-6s %12s %12s\n", "psm", "read Mpx/s", "write Mpx/s");
+	for (const auto& format : FORMATS) {
+		double read = measure([&](uint32_t y) {
+			gs_read_span(vram.data(), format.psm, 0, WIDTH / 64, 0, y, WIDTH, row.data());
+			sum += row[y % WIDTH];
+		});
+		double write = measure([&](uint32_t y) {
+			gs_write_span(vram.data(), format.psm, 0, WIDTH / 64, 0, y, WIDTH, row.data());
+		});
+		std::printf("%-6s %12.1f %12.1f\n", format.name, read, write);
+	}
+	std::printf("checksum %08x\n", sum);
+}
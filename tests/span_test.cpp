@@ -0,0 +1,120 @@
+// gs_read_span and gs_write_span agree with reading and writing one pixel at a time at gs_pixel_address,
+// for every pixel storage format and for spans that start and end in the middle of 8 pixels
+#include "gs_format.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+	constexpr uint32_t BW = 10;
+	constexpr int SPANS = 2000;
+
+	struct Format {
+		const char* name;
+		uint8_t psm;
+	};
+
+	constexpr Format FORMATS[] = {
+		{"CT32", GS_PSMCT32},
+		{"CT24", GS_PSMCT24},
+		{"CT16", GS_PSMCT16},
+		{"CT16S", GS_PSMCT16S},
+		{"T8", GS_PSMT8},
+		{"T4", GS_PSMT4},
+		{"T8H", GS_PSMT8H},
+		{"T4HL", GS_PSMT4HL},
+		{"T4HH", GS_PSMT4HH},
+		{"Z32", GS_PSMZ32},
+		{"Z24", GS_PSMZ24},
+		{"Z16", GS_PSMZ16},
+		{"Z16S", GS_PSMZ16S}
+	};
+
+	// the word holding a pixel and where in it the pixel is
+	uint32_t& pixel_word(std::vector<uint8_t>& vram, uint8_t psm, uint32_t bp, uint32_t x, uint32_t y, uint32_t& shift) {
+		auto field = gs_psm_field(psm);
+		uint32_t addr = gs_pixel_address(gs_get_swizzle(psm), bp, BW, x, y);
+		uint32_t sub = addr & ((1U << field.unit_shift) - 1);
+		shift = field.unit_shift ? sub * (32 >> field.unit_shift) : field.shift;
+		return reinterpret_cast<uint32_t*>(vram.data())[addr >> field.unit_shift];
+	}
+
+	uint32_t read_pixel(std::vector<uint8_t>& vram, uint8_t psm, uint32_t bp, uint32_t x, uint32_t y) {
+		auto field = gs_psm_field(psm);
+		uint32_t shift;
+		uint32_t value = pixel_word(vram, psm, bp, x, y, shift) >> shift & field.mask;
+		return field.color16 ? gs_expand16(value) : value;
+	}
+
+	void write_pixel(std::vector<uint8_t>& vram, uint8_t psm, uint32_t bp, uint32_t x, uint32_t y, uint32_t value) {
+		auto field = gs_psm_field(psm);
+		if (field.color16) {
+			value = gs_pack16(value);
+		}
+		uint32_t shift;
+		auto& word = pixel_word(vram, psm, bp, x, y, shift);
+		word = (word & ~(field.mask << shift)) | (value & field.mask) << shift;
+	}
+
+	// reads, writes and reads back random spans of one format, returns the spans that went wrong
+	int check_format(uint8_t psm, std::mt19937& rng) {
+		std::vector<uint8_t> vram(GS_VRAM_SIZE);
+		std::generate(vram.begin(), vram.end(), [&] { return static_cast<uint8_t>(rng()); });
+		// the same writes made a pixel at a time
+		auto expected = vram;
+
+		std::vector<uint32_t> in(BW * 64);
+		std::vector<uint32_t> out(BW * 64);
+		int bad = 0;
+		for (int i = 0; i < SPANS; ++i) {
+			// a block of the first two pages or one further in
+			uint32_t bp = i % 2 ? 0 : 0x1A0;
+			uint32_t y = rng() % 256;
+			uint32_t x = rng() % (BW * 64);
+			uint32_t count = 1 + rng() % std::min<uint32_t>(BW * 64 - x, 40);
+
+			gs_read_span(vram.data(), psm, bp, BW, x, y, count, out.data());
+			for (uint32_t j = 0; j < count; ++j) {
+				if (out[j] != read_pixel(expected, psm, bp, x + j, y)) {
+					++bad;
+					break;
+				}
+			}
+
+			std::generate_n(in.begin(), count, [&] { return static_cast<uint32_t>(rng()); });
+			gs_write_span(vram.data(), psm, bp, BW, x, y, count, in.data());
+			for (uint32_t j = 0; j < count; ++j) {
+				write_pixel(expected, psm, bp, x + j, y, in[j]);
+			}
+
+			// what was written reads back as the format stores it
+			gs_read_span(vram.data(), psm, bp, BW, x, y, count, out.data());
+			for (uint32_t j = 0; j < count; ++j) {
+				if (out[j] != read_pixel(expected, psm, bp, x + j, y)) {
+					++bad;
+					break;
+				}
+			}
+		}
+		// pixels around the spans and the other bits of shared words are left alone
+		if (vram != expected) {
+			++bad;
+		}
+		return bad;
+	}
+}
+
+int main() {
+	std::mt19937 rng {1};
+	bool ok = true;
+	for (const auto& format : FORMATS) {
+		int bad = check_format(format.psm, rng);
+		if (bad) {
+			std::cerr << "span_test: " << format.name << " has " << bad << " bad spans\n";
+			ok = false;
+		}
+	}
+	return ok ? 0 : 1;
+}